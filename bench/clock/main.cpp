@@ -0,0 +1,245 @@
+// Measures the cost of converting clock ticks to microseconds, and
+// checks the conversion against an exact 128-bit multiply-divide.
+//
+// ./build --src-dir bench/clock --output-dir builds/bench-clock release
+
+#include <micros/api.h>
+
+#include "../../runtime/allocator_type.h"
+#include "../../runtime/clock.h"
+#include "../../runtime/clock_type.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+static void* std_alloc(struct Allocator* self, size_t size)
+{
+        return malloc(size);
+}
+
+static void std_free(struct Allocator* self, void* ptr)
+{
+        return free(ptr);
+}
+
+static struct Allocator std_allocator = { std_alloc, std_free };
+
+/// the runtime expects a video entry point
+extern void render_next_gl3(uint64_t time_micros, struct Display display)
+{
+}
+
+/// full 128 bits product of a and b, from their 32 bits halves
+static void multiply_128(uint64_t a, uint64_t b, uint64_t* high, uint64_t* low)
+{
+        uint64_t const mask = 0xffffffffu;
+        uint64_t const low_low = (a & mask) * (b & mask);
+        uint64_t const low_high = (a & mask) * (b >> 32);
+        uint64_t const high_low = (a >> 32) * (b & mask);
+        uint64_t const high_high = (a >> 32) * (b >> 32);
+        uint64_t const middle = (low_low >> 32) + (low_high & mask) +
+                                (high_low & mask);
+        *low = middle << 32 | (low_low & mask);
+        *high = high_high + (low_high >> 32) + (high_low >> 32) +
+                (middle >> 32);
+}
+
+/// lower 64 bits of floor(high:low / divisor), by long division
+static uint64_t divide_128(uint64_t high, uint64_t low, uint64_t divisor)
+{
+        if (0 == high) {
+                return low / divisor;
+        }
+
+        uint64_t remainder = high % divisor;
+        uint64_t quotient = 0;
+        for (int i = 63; i >= 0; i--) {
+                bool const carry = remainder >> 63;
+                remainder = remainder << 1 | (low >> i & 1);
+                quotient <<= 1;
+                if (carry || remainder >= divisor) {
+                        remainder -= divisor;
+                        quotient |= 1;
+                }
+        }
+        return quotient;
+}
+
+static uint64_t exact_microseconds(uint64_t numerator, uint64_t denominator,
+                                   uint64_t ticks)
+{
+        uint64_t high, low;
+        multiply_128(ticks, numerator, &high, &low);
+        return divide_128(high, low, denominator);
+}
+
+/// xorshift64*, so that runs are reproducible
+static uint64_t next_random(uint64_t* state)
+{
+        uint64_t x = *state;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        *state = x;
+        return x * 0x2545f4914f6cdd1dull;
+}
+
+/// uniform in magnitude: as many samples for every power of two
+static uint64_t random_ticks(uint64_t* state, uint64_t limit)
+{
+        uint64_t const bits = next_random(state);
+        int const magnitude = static_cast<int>(bits % 65);
+        uint64_t const ticks = magnitude == 64 ? bits :
+                               next_random(state) &
+                               ((static_cast<uint64_t>(1) << magnitude) - 1);
+        return limit == ~static_cast<uint64_t>(0) ? ticks : ticks % (limit + 1);
+}
+
+struct Ratio {
+        char const* name;
+        uint64_t numerator;
+        uint64_t denominator;
+};
+
+static int check_ratio(struct Ratio const* ratio)
+{
+        struct Clock* clock;
+        if (clock_init_base(&clock, &std_allocator, ratio->numerator,
+                            ratio->denominator)) {
+                printf("%s: could not create clock\n", ratio->name);
+                return 1;
+        }
+
+        uint64_t const numerator = clock->microseconds_per_tick[0];
+        uint64_t const denominator = clock->microseconds_per_tick[1];
+        uint64_t const limit = clock->exact_tick_limit;
+        uint64_t const max = ~static_cast<uint64_t>(0);
+        int failures = 0;
+
+        // ticks sampled at every magnitude, and every tick around the
+        // ends of the exact range
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        uint64_t const window = 1 << 20;
+        uint64_t const sample_count = 16 * window;
+        for (uint64_t i = 0; i < sample_count + 4 * window; i++) {
+                uint64_t ticks;
+                if (i < window) {
+                        ticks = i;
+                } else if (i < 2 * window) {
+                        ticks = limit - (i - window);
+                } else if (i < 3 * window && limit != max) {
+                        ticks = limit + 1 + (i - 2 * window);
+                } else if (i < 4 * window) {
+                        ticks = max - (i - 3 * window);
+                } else {
+                        ticks = random_ticks(&state, max);
+                }
+                uint64_t const micros =
+                        clock_ticks_to_microseconds(clock, ticks);
+                uint64_t const exact =
+                        exact_microseconds(numerator, denominator, ticks);
+                bool const is_exact_range = ticks <= limit;
+                if (is_exact_range ? micros != exact :
+                    micros < exact || micros - exact > 2) {
+                        if (failures++ < 8) {
+                                printf("%s: %llu ticks gave %llu us, "
+                                       "expected %llu\n",
+                                       ratio->name,
+                                       (unsigned long long) ticks,
+                                       (unsigned long long) micros,
+                                       (unsigned long long) exact);
+                        }
+                }
+        }
+
+        // consecutive ticks never go back in time
+        uint64_t previous = clock_ticks_to_microseconds(clock, limit);
+        for (uint64_t i = 1; i < window && limit != max; i++) {
+                uint64_t const micros =
+                        clock_ticks_to_microseconds(clock, limit + i);
+                if (micros < previous && failures++ < 8) {
+                        printf("%s: not monotonic at %llu ticks\n",
+                               ratio->name,
+                               (unsigned long long)(limit + i));
+                }
+                previous = micros;
+        }
+
+        double const exact_years =
+                exact_microseconds(numerator, denominator, limit) /
+                (1e6 * 3600.0 * 24.0 * 365.25);
+        printf("%-24s %llu/%llu: multiplier %016llx >> %d, exact for "
+               "%.1f years: %s\n", ratio->name,
+               (unsigned long long) numerator,
+               (unsigned long long) denominator,
+               (unsigned long long) clock->microseconds_per_tick_multiplier,
+               clock->microseconds_per_tick_shift, exact_years,
+               failures ? "FAILED" : "ok");
+
+        clock_deinit(&clock);
+        return failures ? 1 : 0;
+}
+
+template <typename Convert>
+static double nanoseconds_per_call(Convert convert)
+{
+        int const count = 1 << 24;
+        uint64_t ticks = 0x0123456789abull;
+        uint64_t sum = 0;
+        auto const start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+                // each conversion depends on the last one
+                sum += convert(ticks + (sum & 1));
+                ticks += 1000003;
+        }
+        auto const end = std::chrono::steady_clock::now();
+        if (sum == 42) {
+                printf("\n");
+        }
+        return std::chrono::duration<double, std::nano>(end - start).count() /
+               count;
+}
+
+int main(int argc, char** argv)
+{
+        struct Ratio const ratios[] = {
+                { "linux CLOCK_MONOTONIC", 1, 1000 },
+                { "tsc 2.918 GHz", 1000, 2918000 },
+                { "tsc 3.579545 GHz", 1000, 3579545 },
+                { "qpc 10 MHz", 1000000, 10000000 },
+                { "qpc 3.579545 MHz", 1000000, 3579545 },
+                { "qpc 1 MHz", 1000000, 1000000 },
+                { "mach 125/3", 125, 3000 },
+        };
+
+        int failures = 0;
+        for (auto const& ratio : ratios) {
+                failures += check_ratio(&ratio);
+        }
+
+        struct Clock* clock;
+        if (clock_init(&clock, &std_allocator)) {
+                printf("could not create the clock\n");
+                return 1;
+        }
+        uint64_t const numerator = clock->microseconds_per_tick[0];
+        uint64_t const denominator = clock->microseconds_per_tick[1];
+
+        printf("clock_ticks_to_microseconds: %.2f ns\n",
+        nanoseconds_per_call([clock](uint64_t ticks) {
+                return clock_ticks_to_microseconds(clock, ticks);
+        }));
+        printf("128-bit multiply-divide: %.2f ns\n",
+        nanoseconds_per_call([numerator, denominator](uint64_t ticks) {
+                return exact_microseconds(numerator, denominator, ticks);
+        }));
+        printf("clock_microseconds: %.2f ns\n",
+        nanoseconds_per_call([clock](uint64_t ticks) {
+                return clock_microseconds(clock) + (ticks & 1);
+        }));
+
+        clock_deinit(&clock);
+        return failures ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+// Stresses the audio pool allocator against malloc, while video
+// threads keep the system allocator busy.
+//
+// The audio thread repeatedly simulates a render: it allocates blocks of
+// mixed sizes, frees most of them and hands the others over to a video
+// thread, which frees them from there. The time each render spends in
+// the allocator is recorded and summarized as percentiles.
+//
+// ./build --src-dir bench/pool-allocator --output-dir builds/bench-pool release
+
+#include <micros/api.h>
+
+#include "../../runtime/allocator_type.h"
+#include "../../runtime/pool_allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static void* std_alloc(struct Allocator* self, size_t size)
+{
+        return malloc(size);
+}
+
+static void std_free(struct Allocator* self, void* ptr)
+{
+        return free(ptr);
+}
+
+static struct Allocator std_allocator = { std_alloc, std_free };
+
+/// the runtime expects a video entry point
+extern void render_next_gl3(uint64_t time_micros, struct Display display)
+{
+}
+
+enum {
+        BLOCKS_PER_RENDER = 16,
+        HANDOVER_CAPACITY = 1024, // power of two
+};
+
+/// xorshift64*, so that runs are reproducible
+static uint64_t next_random(uint64_t* state)
+{
+        uint64_t x = *state;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        *state = x;
+        return x * 0x2545f4914f6cdd1dull;
+}
+
+/// blocks passed from the audio thread to be freed by a video thread
+struct Handover {
+        void* blocks[HANDOVER_CAPACITY];
+        std::atomic<uint64_t> write_count;
+        std::atomic<uint64_t> read_count;
+};
+
+static bool handover_push(struct Handover* handover, void* block)
+{
+        uint64_t const write = handover->write_count.load(
+                                       std::memory_order_relaxed);
+        if (write - handover->read_count.load(std::memory_order_acquire) ==
+            HANDOVER_CAPACITY) {
+                return false;
+        }
+        handover->blocks[write % HANDOVER_CAPACITY] = block;
+        handover->write_count.store(write + 1, std::memory_order_release);
+        return true;
+}
+
+static void* handover_pop(struct Handover* handover)
+{
+        uint64_t const read = handover->read_count.load(
+                                      std::memory_order_relaxed);
+        if (read == handover->write_count.load(std::memory_order_acquire)) {
+                return NULL;
+        }
+        void* block = handover->blocks[read % HANDOVER_CAPACITY];
+        handover->read_count.store(read + 1, std::memory_order_release);
+        return block;
+}
+
+struct Stress {
+        struct Allocator* audio_allocator;
+        struct Handover handover;
+        bool has_video_threads;
+        std::atomic<bool> is_running;
+        std::atomic<uint64_t> video_allocations;
+        int failed_allocations;
+};
+
+/// allocates and frees like a frame would, up to 64KiB at a time
+static void video_thread(struct Stress* stress, int index)
+{
+        std::vector<void*> live(256, NULL);
+        uint64_t state = 0x9e3779b97f4a7c15ull + index;
+        uint64_t allocations = 0;
+        while (stress->is_running.load(std::memory_order_relaxed)) {
+                if (index == 0) {
+                        while (void* block = handover_pop(&stress->handover)) {
+                                allocator_free(stress->audio_allocator, block);
+                        }
+                }
+                uint64_t const bits = next_random(&state);
+                size_t const slot = bits % live.size();
+                size_t const size = 16 + (bits >> 16) % (64 * 1024);
+                free(live[slot]);
+                live[slot] = malloc(size);
+                memset(live[slot], 0, std::min<size_t>(size, 256));
+                allocations++;
+        }
+        for (void* block : live) {
+                free(block);
+        }
+        stress->video_allocations.fetch_add(allocations);
+}
+
+/// @return the nanoseconds each render spent allocating and freeing
+static std::vector<double> audio_renders(struct Stress* stress,
+                                        struct PoolAllocator* pool,
+                                        int render_count)
+{
+        if (pool) {
+                pool_allocator_claim(pool);
+        }
+
+        std::vector<double> render_nanoseconds;
+        render_nanoseconds.reserve(render_count);
+        uint64_t state = 0x2545f4914f6cdd1dull;
+        for (int i = 0; i < render_count; i++) {
+                void* blocks[BLOCKS_PER_RENDER];
+                size_t sizes[BLOCKS_PER_RENDER];
+                for (int j = 0; j < BLOCKS_PER_RENDER; j++) {
+                        sizes[j] = static_cast<size_t>(16) <<
+                                   (next_random(&state) % 8);
+                }
+
+                using Clock = std::chrono::steady_clock;
+                auto const start = Clock::now();
+                for (int j = 0; j < BLOCKS_PER_RENDER; j++) {
+                        blocks[j] = allocator_alloc(stress->audio_allocator,
+                                                    sizes[j]);
+                        if (blocks[j]) {
+                                static_cast<char*>(blocks[j])[0] = 1;
+                        }
+                }
+                // one block in four outlives the render
+                for (int j = 0; j < BLOCKS_PER_RENDER; j++) {
+                        if (!blocks[j]) {
+                                stress->failed_allocations++;
+                                continue;
+                        }
+                        if (j % 4 == 0 && stress->has_video_threads &&
+                            handover_push(&stress->handover, blocks[j])) {
+                                continue;
+                        }
+                        allocator_free(stress->audio_allocator, blocks[j]);
+                }
+                auto const end = Clock::now();
+                render_nanoseconds.push_back(
+                        std::chrono::duration<double, std::nano>(end - start)
+                        .count());
+        }
+        return render_nanoseconds;
+}
+
+static void run(char const* name, struct Allocator* allocator,
+                struct PoolAllocator* pool, int video_thread_count)
+{
+        int const render_count = 1000000;
+
+        struct Stress stress;
+        stress.audio_allocator = allocator;
+        stress.handover.write_count.store(0);
+        stress.handover.read_count.store(0);
+        stress.has_video_threads = video_thread_count > 0;
+        stress.is_running.store(true);
+        stress.video_allocations.store(0);
+        stress.failed_allocations = 0;
+
+        std::vector<std::thread> video_threads;
+        for (int i = 0; i < video_thread_count; i++) {
+                video_threads.emplace_back(video_thread, &stress, i);
+        }
+
+        using Clock = std::chrono::steady_clock;
+        auto const start = Clock::now();
+        std::vector<double> nanoseconds = audio_renders(&stress, pool,
+                                          render_count);
+        auto const end = Clock::now();
+        double const seconds = std::chrono::duration<double>(end - start)
+                               .count();
+
+        stress.is_running.store(false);
+        for (auto& thread : video_threads) {
+                thread.join();
+        }
+        while (void* block = handover_pop(&stress.handover)) {
+                allocator_free(allocator, block);
+        }
+
+        std::sort(nanoseconds.begin(), nanoseconds.end());
+        auto const percentile = [&nanoseconds](double p) {
+                return nanoseconds[static_cast<size_t>(
+                                           p * (nanoseconds.size() - 1))];
+        };
+        double total = 0.0;
+        for (double ns : nanoseconds) {
+                total += ns;
+        }
+        printf("%-6s %d video threads (%.1fM allocations/s): "
+               "ns per render mean %.0f, p50 %.0f, p99 %.0f, p99.9 %.0f, "
+               "p99.99 %.0f, max %.0f%s\n",
+               name, video_thread_count,
+               stress.video_allocations.load() / seconds / 1e6,
+               total / nanoseconds.size(), percentile(0.5),
+               percentile(0.99), percentile(0.999), percentile(0.9999),
+               nanoseconds.back(),
+               stress.failed_allocations ? " (allocations failed)" : "");
+}
+
+int main(int argc, char** argv)
+{
+        int const cpu_count = static_cast<int>(
+                                      std::thread::hardware_concurrency());
+        int const video_thread_count = std::max(1, cpu_count - 1);
+
+        struct PoolAllocator pool;
+        if (pool_allocator_init(&pool, &std_allocator, 16 * 1024 * 1024, 0)) {
+                printf("could not create the pool\n");
+                return 1;
+        }
+
+        for (int pass = 0; pass < 2; pass++) {
+                run("malloc", &std_allocator, NULL, 0);
+                run("pool", &pool.allocator, &pool, 0);
+                run("malloc", &std_allocator, NULL, video_thread_count);
+                run("pool", &pool.allocator, &pool, video_thread_count);
+        }
+
+        pool_allocator_deinit(&pool);
+        return 0;
+}
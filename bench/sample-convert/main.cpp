@@ -0,0 +1,308 @@
+// Measures the sample conversions chosen by the runtime against plain
+// scalar loops, in nanoseconds per stereo frame, for the block sizes
+// audio devices commonly ask for.
+//
+// ./build --src-dir bench/sample-convert --output-dir builds/bench-convert release
+
+#include <micros/api.h>
+
+#include "../../runtime/sample_convert.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+static double const s16_scale = 32767.0;
+static double const s32_scale = 2147483647.0;
+
+/// the runtime expects a video entry point
+extern void render_next_gl3(uint64_t time_micros, struct Display display)
+{
+}
+
+static double clip(double sample)
+{
+        return sample < -1.0 ? -1.0 : (sample > 1.0 ? 1.0 : sample);
+}
+
+static void scalar_f64_planar_to_f32(float interleaved[],
+                                     double const left[],
+                                     double const right[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                interleaved[2 * i] = (float) left[i];
+                interleaved[2 * i + 1] = (float) right[i];
+        }
+}
+
+static void scalar_f64_planar_to_s16(int16_t interleaved[],
+                                     double const left[],
+                                     double const right[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                interleaved[2 * i] =
+                        static_cast<int16_t>(lrint(clip(left[i]) * s16_scale));
+                interleaved[2 * i + 1] =
+                        static_cast<int16_t>(lrint(clip(right[i]) * s16_scale));
+        }
+}
+
+static void scalar_f64_planar_to_s32(int32_t interleaved[],
+                                     double const left[],
+                                     double const right[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                interleaved[2 * i] =
+                        static_cast<int32_t>(lrint(clip(left[i]) * s32_scale));
+                interleaved[2 * i + 1] =
+                        static_cast<int32_t>(lrint(clip(right[i]) * s32_scale));
+        }
+}
+
+static void scalar_f32_to_f64_planar(double left[],
+                                     double right[],
+                                     float const interleaved[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                left[i] = interleaved[2 * i];
+                right[i] = interleaved[2 * i + 1];
+        }
+}
+
+static void scalar_s16_to_f64_planar(double left[],
+                                     double right[],
+                                     int16_t const interleaved[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                left[i] = interleaved[2 * i] / s16_scale;
+                right[i] = interleaved[2 * i + 1] / s16_scale;
+        }
+}
+
+static void scalar_s32_to_f64_planar(double left[],
+                                     double right[],
+                                     int32_t const interleaved[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                left[i] = interleaved[2 * i] / s32_scale;
+                right[i] = interleaved[2 * i + 1] / s32_scale;
+        }
+}
+
+static void scalar_f32_to_s16_frames(int16_t dest[],
+                                     float const source[],
+                                     int frame_count)
+{
+        float const scale = static_cast<float>(s16_scale);
+        for (int i = 0; i < 2 * frame_count; i++) {
+                float const sample = source[i] < -1.0f ? -1.0f :
+                                     (source[i] > 1.0f ? 1.0f : source[i]);
+                dest[i] = static_cast<int16_t>(lrintf(sample * scale));
+        }
+}
+
+static void runtime_f32_to_s16_frames(int16_t dest[],
+                                      float const source[],
+                                      int frame_count)
+{
+        sample_convert_f32_to_s16(dest, source, 2 * frame_count);
+}
+
+enum {
+        MAX_FRAMES = 4096,
+};
+
+/// enough to hold any of the buffers in the largest block
+struct Buffers {
+        double left[MAX_FRAMES];
+        double right[MAX_FRAMES];
+        float f32[2 * MAX_FRAMES];
+        int16_t s16[2 * MAX_FRAMES];
+        int32_t s32[2 * MAX_FRAMES];
+};
+
+static struct Buffers buffers;
+
+static void fill_buffers()
+{
+        for (int i = 0; i < MAX_FRAMES; i++) {
+                // slightly over full scale, to exercise the clipping
+                buffers.left[i] = 1.1 * sin(0.01 * i);
+                buffers.right[i] = 1.1 * cos(0.013 * i);
+                buffers.f32[2 * i] = static_cast<float>(buffers.left[i]);
+                buffers.f32[2 * i + 1] = static_cast<float>(buffers.right[i]);
+                buffers.s16[2 * i] = static_cast<int16_t>(i * 7);
+                buffers.s16[2 * i + 1] = static_cast<int16_t>(-i * 11);
+                buffers.s32[2 * i] = i * 524287;
+                buffers.s32[2 * i + 1] = -i * 131071;
+        }
+}
+
+typedef void (*Convert)(int frame_count);
+
+/// runs the conversion until about 50ms have passed
+static double nanoseconds_per_frame(Convert convert, int frame_count)
+{
+        using Clock = std::chrono::steady_clock;
+        long long frames = 0;
+        auto const start = Clock::now();
+        auto end = start;
+        do {
+                for (int i = 0; i < 256; i++) {
+                        convert(frame_count);
+                }
+                frames += 256LL * frame_count;
+                end = Clock::now();
+        } while (end - start < std::chrono::milliseconds(50));
+
+        return std::chrono::duration<double, std::nano>(end - start).count() /
+               frames;
+}
+
+static void report(char const* name, Convert scalar, Convert runtime)
+{
+        int const frame_counts[] = { 64, 256, 1024, 4096 };
+        for (int frame_count : frame_counts) {
+                double const scalar_ns = nanoseconds_per_frame(scalar,
+                                         frame_count);
+                double const runtime_ns = nanoseconds_per_frame(runtime,
+                                          frame_count);
+                printf("%-18s %5d frames: scalar %6.3f ns/frame, "
+                       "%s %6.3f ns/frame (x%.1f)\n", name, frame_count,
+                       scalar_ns, sample_convert_implementation(),
+                       runtime_ns, scalar_ns / runtime_ns);
+        }
+}
+
+/// the kernels must agree with the scalar loops before being compared
+template <typename Sample>
+static int check_same(char const* name, Sample const* expected,
+                      Sample const* actual, int count)
+{
+        if (memcmp(expected, actual, count * sizeof *actual)) {
+                printf("%s: %s differs from the scalar loop\n", name,
+                       sample_convert_implementation());
+                return 1;
+        }
+        return 0;
+}
+
+static int check_kernels()
+{
+        static struct Buffers expected;
+        static struct Buffers actual;
+        int const n = MAX_FRAMES - 3; // exercises the remainders
+        int failures = 0;
+
+        scalar_f64_planar_to_f32(expected.f32, buffers.left, buffers.right, n);
+        sample_convert_f64_planar_to_f32(actual.f32, buffers.left,
+                                         buffers.right, n);
+        failures += check_same("f64_planar_to_f32", expected.f32, actual.f32,
+                               2 * n);
+
+        scalar_f64_planar_to_s16(expected.s16, buffers.left, buffers.right, n);
+        sample_convert_f64_planar_to_s16(actual.s16, buffers.left,
+                                         buffers.right, n);
+        failures += check_same("f64_planar_to_s16", expected.s16, actual.s16,
+                               2 * n);
+
+        scalar_f64_planar_to_s32(expected.s32, buffers.left, buffers.right, n);
+        sample_convert_f64_planar_to_s32(actual.s32, buffers.left,
+                                         buffers.right, n);
+        failures += check_same("f64_planar_to_s32", expected.s32, actual.s32,
+                               2 * n);
+
+        scalar_f32_to_f64_planar(expected.left, expected.right, buffers.f32, n);
+        sample_convert_f32_to_f64_planar(actual.left, actual.right,
+                                         buffers.f32, n);
+        failures += check_same("f32_to_f64_planar", expected.left,
+                               actual.left, n);
+        failures += check_same("f32_to_f64_planar", expected.right,
+                               actual.right, n);
+
+        scalar_s16_to_f64_planar(expected.left, expected.right, buffers.s16, n);
+        sample_convert_s16_to_f64_planar(actual.left, actual.right,
+                                         buffers.s16, n);
+        failures += check_same("s16_to_f64_planar", expected.left,
+                               actual.left, n);
+        failures += check_same("s16_to_f64_planar", expected.right,
+                               actual.right, n);
+
+        scalar_s32_to_f64_planar(expected.left, expected.right, buffers.s32, n);
+        sample_convert_s32_to_f64_planar(actual.left, actual.right,
+                                         buffers.s32, n);
+        failures += check_same("s32_to_f64_planar", expected.left,
+                               actual.left, n);
+        failures += check_same("s32_to_f64_planar", expected.right,
+                               actual.right, n);
+
+        scalar_f32_to_s16_frames(expected.s16, buffers.f32, n);
+        runtime_f32_to_s16_frames(actual.s16, buffers.f32, n);
+        failures += check_same("f32_to_s16", expected.s16, actual.s16, 2 * n);
+
+        return failures;
+}
+
+static struct Buffers out;
+
+int main(int argc, char** argv)
+{
+        fill_buffers();
+
+        int const failures = check_kernels();
+
+        report("f64_planar_to_f32", [](int n) {
+                scalar_f64_planar_to_f32(out.f32, buffers.left,
+                                         buffers.right, n);
+        }, [](int n) {
+                sample_convert_f64_planar_to_f32(out.f32, buffers.left,
+                                                 buffers.right, n);
+        });
+        report("f64_planar_to_s16", [](int n) {
+                scalar_f64_planar_to_s16(out.s16, buffers.left,
+                                         buffers.right, n);
+        }, [](int n) {
+                sample_convert_f64_planar_to_s16(out.s16, buffers.left,
+                                                 buffers.right, n);
+        });
+        report("f64_planar_to_s32", [](int n) {
+                scalar_f64_planar_to_s32(out.s32, buffers.left,
+                                         buffers.right, n);
+        }, [](int n) {
+                sample_convert_f64_planar_to_s32(out.s32, buffers.left,
+                                                 buffers.right, n);
+        });
+        report("f32_to_f64_planar", [](int n) {
+                scalar_f32_to_f64_planar(out.left, out.right, buffers.f32, n);
+        }, [](int n) {
+                sample_convert_f32_to_f64_planar(out.left, out.right,
+                                                 buffers.f32, n);
+        });
+        report("s16_to_f64_planar", [](int n) {
+                scalar_s16_to_f64_planar(out.left, out.right, buffers.s16, n);
+        }, [](int n) {
+                sample_convert_s16_to_f64_planar(out.left, out.right,
+                                                 buffers.s16, n);
+        });
+        report("s32_to_f64_planar", [](int n) {
+                scalar_s32_to_f64_planar(out.left, out.right, buffers.s32, n);
+        }, [](int n) {
+                sample_convert_s32_to_f64_planar(out.left, out.right,
+                                                 buffers.s32, n);
+        });
+        report("f32_to_s16", [](int n) {
+                scalar_f32_to_s16_frames(out.s16, buffers.f32, n);
+        }, [](int n) {
+                runtime_f32_to_s16_frames(out.s16, buffers.f32, n);
+        });
+
+        return failures ? 1 : 0;
+}
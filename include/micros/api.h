@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 /// initialize runtime (and start the demo)
@@ -10,7 +11,13 @@ extern uint64_t now_micros();
 
 /// information about a display
 struct Display {
-        // the dimensions of the display's framebuffer in pixels
+        // the dimensions of the framebuffer to render into, in pixels.
+        // With dynamic resolution, it is an offscreen framebuffer
+        // smaller than the window, bound when the frame starts: bind it
+        // back rather than framebuffer 0 after rendering elsewhere.
+        // Upscaling it to the window then leaves the program, vertex
+        // array, texture and capabilities (blend, depth test...) at
+        // their defaults: set the state a frame relies on each frame.
         uint32_t framebuffer_width_px;
         uint32_t framebuffer_height_px;
 };
@@ -20,11 +27,59 @@ struct Display {
  *
  * It will be called in strict time order by the runtime.
  *
- * @param time_micros scheduling time for the frame
+ * @param time_micros time at which the frame is expected to be
+ * presented on the display
  */
 extern void render_next_gl3(uint64_t time_micros,
                             struct Display display);
 
+/// version of struct FrameInfo filled by this runtime
+#define MICROS_FRAME_INFO_VERSION 1
+
+/**
+ * information about a video frame.
+ *
+ * Fields are only ever appended to it, each version adding some:
+ * check version before reading fields more recent than your demo.
+ */
+struct FrameInfo {
+        uint32_t version; // MICROS_FRAME_INFO_VERSION of the runtime
+        uint32_t size; // of the struct filled by the runtime, in bytes
+
+        // version 1
+        struct Display display;
+        // frames rendered before this one, starting at 0
+        uint64_t frame_index;
+        // same as the time_micros of render_next_gl3
+        uint64_t time_micros;
+        // from the previous frame's time_micros, 0 on the first frame
+        // and when time went backwards (i.e. after a seek)
+        uint64_t delta_micros;
+        // estimated period of the display's refresh
+        uint64_t refresh_period_micros;
+        // when the runtime started the frame, and when it predicts the
+        // frame to be presented, both in real time (unlike now_micros,
+        // which follows the virtual clock.) Their difference is the
+        // time left to render the frame.
+        uint64_t begin_micros;
+        uint64_t present_micros;
+        // framebuffer pixels per screen coordinate, i.e. 2.0 on high
+        // density displays, smaller with dynamic resolution
+        float content_scale_x;
+        float content_scale_y;
+        // width over height of a framebuffer pixel, as seen on the
+        // display
+        float pixel_aspect_ratio;
+};
+
+/**
+ * optional entry point: called for each new video frame instead of
+ * render_next_gl3 when the demo defines it.
+ *
+ * It will be called in strict time order by the runtime.
+ */
+extern void render_next_frame_gl3(struct FrameInfo const* frame_info);
+
 /**
  * entry point: called for each new audio frame.
  *
@@ -38,3 +93,100 @@ extern void render_next_gl3(uint64_t time_micros,
 extern void render_next_2chn_48khz_audio(uint64_t time_micros,
                 int const sample_count, double left[/*sample_count*/],
                 double right[/*sample_count*/]);
+
+/**
+ * optional entry point: called for each new audio frame instead of
+ * render_next_2chn_48khz_audio when the demo defines it.
+ *
+ * Samples are written directly into the device's buffer, skipping
+ * the conversion from double.
+ *
+ * @param time_micros scheduling time for the first sample of the frame
+ * @param sample_count count of stereo audio sample to fill
+ * @param interleaved buffer of audio samples, left then right
+ */
+extern void render_next_2chn_48khz_audio_f32(uint64_t time_micros,
+                int const sample_count,
+                float interleaved[/*2*sample_count*/]);
+
+/// statistics about the rendering of audio
+struct AudioStats {
+        // calls to the audio entry points, and those which took longer
+        // than the duration of the audio they rendered
+        uint64_t render_count;
+        uint64_t late_render_count;
+        // device under/overruns
+        uint64_t xrun_count;
+        // device callbacks which found the lookahead short of frames
+        uint64_t underrun_count;
+        // highest load: render time over duration of the audio rendered
+        double max_load;
+        // render counts per load, in steps of 1/8 (the last step also
+        // counts all loads above 1.875)
+        uint64_t load_histogram[16];
+};
+
+/// copies the statistics gathered since the start of the runtime
+extern void query_audio_stats(struct AudioStats* stats);
+
+struct Allocator;
+
+extern void* allocator_alloc(struct Allocator* allocator, size_t size);
+extern void allocator_free(struct Allocator* allocator, void* ptr);
+
+/**
+ * scratch memory for the current frame of the calling thread.
+ *
+ * Memory allocated from it is valid until the entry point being run
+ * returns: the runtime reclaims all of it after each call to
+ * render_next_gl3 and to the audio entry points. Allocating from it
+ * never touches the heap, and returns NULL once it is exhausted
+ * (MICROS_FRAME_ARENA_BYTES sets its size, 4MiB by default.)
+ *
+ * Each thread has its own, so the video and audio entry points may use
+ * it concurrently.
+ */
+extern struct Allocator* frame_allocator();
+
+/**
+ * memory for the audio entry points, which may be kept from one call
+ * to the next.
+ *
+ * Blocks of up to 4096 bytes are allocated up front, and given out
+ * without locking or touching the heap. Only the thread calling the
+ * audio entry points may allocate, while any thread may free.
+ * MICROS_AUDIO_POOL_BYTES sets its size, 4MiB by default, 36KiB at least.
+ */
+extern struct Allocator* audio_allocator();
+
+/**
+ * memory for data built once and kept for long, such as procedurally
+ * generated meshes and textures.
+ *
+ * Its address space is reserved up front and backed by memory as it
+ * gets used, on huge pages when available. Allocations never move and
+ * freeing them does nothing: reset_asset_allocator() reclaims all of
+ * them at once. Use it from one thread at a time.
+ * MICROS_ASSET_ARENA_BYTES sets the size of its reservation, 1GiB by
+ * default.
+ */
+extern struct Allocator* asset_allocator();
+
+/**
+ * grows the latest allocation of asset_allocator() in place, without
+ * copying it.
+ *
+ * @return false when ptr is not the latest allocation or memory is
+ * exhausted, leaving the allocation untouched.
+ */
+extern bool grow_asset_allocation(void* ptr, size_t size);
+
+/// reclaims all memory allocated from asset_allocator()
+extern void reset_asset_allocator();
+
+/**
+ * prints the memory used through the runtime's allocators, per thread
+ * and per allocator, when built with MICROS_TRACK_NEW or run with
+ * MICROS_TRACK_MEMORY=1.
+ */
+extern void print_memory_stats();
@@ -0,0 +1,33 @@
+#pragma once
+/**
+   @file
+   Named scopes for profiling the video entry point.
+
+   With MICROS_PROFILE=1, the runtime measures the cpu and gpu time of
+   each call to render_next_gl3, and of the scopes opened inside of it.
+   Scopes may be nested, and are identified by their name and parent.
+   Rolling averages and percentiles are printed when rendering ends.
+
+   Scopes may only be opened from render_next_gl3, and cost next to
+   nothing when profiling is disabled.
+*/
+
+/// @param name a string which outlives the profiler, like a literal
+extern void profile_scope_begin(char const* name);
+extern void profile_scope_end();
+
+/// profiles the enclosing block
+struct ProfileScope {
+        explicit ProfileScope(char const* name)
+        {
+                profile_scope_begin(name);
+        }
+
+        ~ProfileScope()
+        {
+                profile_scope_end();
+        }
+
+        ProfileScope(ProfileScope const&) = delete;
+        ProfileScope& operator=(ProfileScope const&) = delete;
+};
@@ -14,7 +14,11 @@
 
 #include <micros/api.h>
 
+#include "../audio_render.h"
+#include "../audio_stats.h"
 #include "../clock.h"
+#include "../frame_arena.h"
+#include "../tracking_allocator.h"
 
 //! what are the selected channels for our stereo stream
 struct StereoChannelDesc {
@@ -33,6 +37,10 @@ OSStatus audio_callback(AudioDeviceID           inDevice,
         struct StereoChannelDesc const * const selected_channels =
                         static_cast<struct StereoChannelDesc*>(inClientData);
 
+        // CoreAudio owns this thread, which we only get to see here
+        frame_arena_prepare_thread();
+        tracking_allocator_prepare_thread();
+
         struct {
                 float* buffer;
                 int stride;
@@ -75,27 +83,28 @@ OSStatus audio_callback(AudioDeviceID           inDevice,
                 return noErr;
         }
 
-        // ask our client to generate content into temporary buffers
         int const frame_count = output[0].frame_count;
-        double left_client_buffer[frame_count];
-        double right_client_buffer[frame_count];
-
-        memset(left_client_buffer, 0, sizeof left_client_buffer);
-        memset(right_client_buffer, 0, sizeof right_client_buffer);
+        uint64_t const buffer_micros =
+                clock_ticks_to_microseconds(selected_channels->clock,
+                                            inOutputTime->mHostTime);
+
+        if (output[0].stride == 2 && output[1].stride == 2 &&
+            output[1].buffer == output[0].buffer + 1) {
+                // our channels are interleaved, render in place
+                audio_render_2chn_f32(buffer_micros, frame_count, output[0].buffer);
+                return noErr;
+        }
 
-        render_next_2chn_48khz_audio
-        (clock_ticks_to_microseconds(selected_channels->clock,
-                                     inOutputTime->mHostTime),
-         frame_count,
-         left_client_buffer,
-         right_client_buffer);
+        // ask our client to generate content into a temporary buffer
+        float interleaved[2 * frame_count];
+        audio_render_2chn_f32(buffer_micros, frame_count, interleaved);
 
         for (int i = 0; i < frame_count; i++) {
-                output[0].buffer[i * output[0].stride] = (float) left_client_buffer[i];
+                output[0].buffer[i * output[0].stride] = interleaved[2 * i];
         }
 
         for (int i = 0; i < frame_count; i++) {
-                output[1].buffer[i * output[1].stride] = (float) right_client_buffer[i];
+                output[1].buffer[i * output[1].stride] = interleaved[2 * i + 1];
         }
 
         return noErr;
@@ -120,9 +129,25 @@ OSStatus audio_callback(AudioDeviceID           inDevice,
 static AudioDeviceID mainDeviceID;
 static AudioDeviceIOProcID mainIOProcID;
 
+//! the HAL notifies us when our io proc missed its deadline
+static OSStatus on_processor_overload(AudioObjectID inObjectID,
+                                      UInt32 inNumberAddresses,
+                                      const AudioObjectPropertyAddress inAddresses[],
+                                      void* inClientData)
+{
+        audio_stats_record_xrun();
+        return noErr;
+}
+
+static AudioObjectPropertyAddress const processor_overload_address =
+        HW_PROPERTY_ADDRESS(kAudioDeviceProcessorOverload);
+
 extern void close_stream()
 {
         if (mainDeviceID && mainIOProcID) {
+                AudioObjectRemovePropertyListener(mainDeviceID,
+                                                  &processor_overload_address,
+                                                  on_processor_overload, NULL);
                 (void) (OS_SUCCESS(AudioDeviceStop(mainDeviceID, audio_callback))
                         && OS_SUCCESS(AudioDeviceDestroyIOProcID(mainDeviceID, mainIOProcID))
                         || FAIL_WITH("could not close device"));
@@ -327,6 +352,13 @@ extern void open_stereo48khz_stream(struct Clock* clock)
                         mainDeviceID = outputDevice;
                         mainIOProcID = procID;
 
+                        (void) (OS_SUCCESS(AudioObjectAddPropertyListener
+                                           (outputDevice,
+                                            &processor_overload_address,
+                                            on_processor_overload,
+                                            NULL))
+                                || FAIL_WITH("could not listen to overloads\n"));
+
                         BREAK_ON_ERROR
                         (OS_SUCCESS(AudioDeviceStart(outputDevice, procID))
                          || FAIL_WITH("could not start output device"));
@@ -1 +1,6 @@
-extern void open_window(char const* title, bool prefers_fullscreen);
+struct Clock;
+struct VirtualClock;
+
+extern void open_window(char const* title, bool prefers_fullscreen,
+                        struct Clock* clock,
+                        struct VirtualClock* virtual_clock);
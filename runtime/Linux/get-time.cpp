@@ -0,0 +1,115 @@
+/**
+ * \file
+ *
+ * Clock reading the cpu's time stamp counter when it is invariant,
+ * which is cheaper than a clock_gettime call. Its rate is calibrated
+ * against CLOCK_MONOTONIC_RAW, which also serves as the fallback.
+ *
+ * MICROS_CLOCK=os forces the use of CLOCK_MONOTONIC_RAW.
+ */
+
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strcmp
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CLOCK_HAS_TSC 1
+#endif
+
+#include "../clock.h"
+#include "../clock_type.h"
+#include "../cpu_features.h"
+
+static uint64_t os_clock_nanoseconds()
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000 +
+               static_cast<uint64_t>(now.tv_nsec);
+}
+
+#if defined(CLOCK_HAS_TSC)
+
+/// reads the os clock and the time stamp counter at the same instant
+static void sample_tsc_against_os_clock(uint64_t* tsc, uint64_t* nanoseconds)
+{
+        // retry to find a sample not disturbed by an interruption
+        uint64_t best_duration = ~static_cast<uint64_t>(0);
+        for (int i = 0; i < 16; i++) {
+                uint64_t const tsc_before = __rdtsc();
+                uint64_t const os_nanoseconds = os_clock_nanoseconds();
+                uint64_t const tsc_after = __rdtsc();
+
+                if (tsc_after - tsc_before < best_duration) {
+                        best_duration = tsc_after - tsc_before;
+                        *tsc = tsc_before + best_duration / 2;
+                        *nanoseconds = os_nanoseconds;
+                }
+        }
+}
+
+/// @return the frequency of the time stamp counter in hz
+static uint64_t calibrate_tsc()
+{
+        uint64_t const calibration_nanoseconds = 20000000;
+
+        uint64_t start_tsc, start_nanoseconds;
+        sample_tsc_against_os_clock(&start_tsc, &start_nanoseconds);
+
+        while (os_clock_nanoseconds() - start_nanoseconds <
+               calibration_nanoseconds) {
+        }
+
+        uint64_t end_tsc, end_nanoseconds;
+        sample_tsc_against_os_clock(&end_tsc, &end_nanoseconds);
+
+        return (end_tsc - start_tsc) * 1000000000 /
+               (end_nanoseconds - start_nanoseconds);
+}
+
+#endif
+
+static bool must_use_os_clock()
+{
+        char const* clock_name = getenv("MICROS_CLOCK");
+        return clock_name && 0 == strcmp(clock_name, "os");
+}
+
+extern int clock_init(struct Clock** clockp, struct Allocator* allocator)
+{
+        struct timespec resolution;
+        if (clock_getres(CLOCK_MONOTONIC_RAW, &resolution)) {
+                return -1;
+        }
+
+#if defined(CLOCK_HAS_TSC)
+        if (cpu_has_invariant_tsc() && !must_use_os_clock()) {
+                uint64_t const tsc_hz = calibrate_tsc();
+                int const result = clock_init_base(clockp, allocator,
+                                                   1000, (tsc_hz + 500) / 1000);
+                if (0 == result) {
+                        (*clockp)->source = CLOCK_SOURCE_TSC;
+                        printf("clock: invariant tsc at %.3f MHz\n", tsc_hz / 1e6);
+                }
+                return result;
+        }
+#endif
+
+        // ticks are expressed in nanoseconds
+        return clock_init_base(clockp, allocator, 1, 1000);
+}
+
+extern uint64_t clock_ticks(struct Clock const* const clock)
+{
+#if defined(CLOCK_HAS_TSC)
+        if (CLOCK_SOURCE_TSC == clock->source) {
+                return __rdtsc();
+        }
+#endif
+
+        return os_clock_nanoseconds();
+}
@@ -0,0 +1,2 @@
+/// @return true if the headless video mode was requested and ran
+extern bool run_headless_render(struct Clock* clock);
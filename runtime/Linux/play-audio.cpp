@@ -0,0 +1,303 @@
+/**
+ * \file
+ *
+ * Play a stereo audio stream using ALSA.
+ *
+ * The pcm device is opened in mmap mode, meaning that samples are
+ * written directly inside the device's ring buffer rather than
+ * being copied there by snd_pcm_writei.
+ *
+ * Devices without float support are fed 16bit samples instead,
+ * converted from an intermediate buffer.
+ *
+ * The device can be selected with the MICROS_ALSA_DEVICE environment
+ * variable, for instance "null" runs the stream without any sound
+ * card present.
+ *
+ * The callback thread asks for realtime scheduling, and can be pinned
+ * to a cpu with MICROS_AUDIO_CPU.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../audio_render.h"
+#include "../audio_stats.h"
+#include "../clock.h"
+#include "../frame_arena.h"
+#include "../realtime_thread.h"
+#include "../sample_convert.h"
+#include "../tracking_allocator.h"
+
+#define OS_SUCCESS(call) ((call) >= 0)
+#define THEN_DO(expr) ((expr), 1)
+
+#define FAIL_WITH(...) (THEN_DO(printf(__VA_ARGS__)) && 0)
+#define BREAK_ON_ERROR(expr) \
+        if (!(expr)) {                                                  \
+                return;                                                 \
+        }
+
+/// once the device is open, it is closed before giving up
+#define CLOSE_ON_ERROR(pcm, expr) \
+        if (!(expr)) {                                                  \
+                snd_pcm_close(pcm);                                     \
+                return;                                                 \
+        }
+
+struct AudioCallbackState {
+        struct Clock* clock;
+        snd_pcm_t* pcm;
+        snd_pcm_uframes_t period_frames;
+        snd_pcm_format_t format;
+        float* s16_client_buffer; // for SND_PCM_FORMAT_S16 devices
+        pthread_t thread;
+        std::atomic<bool> must_stop;
+};
+
+static struct AudioCallbackState* main_stream;
+
+static int recover_stream(snd_pcm_t* pcm, int error)
+{
+        if (-EPIPE == error) {
+                audio_stats_record_xrun();
+        }
+
+        int const result = snd_pcm_recover(pcm, error, 1);
+        if (!OS_SUCCESS(result)) {
+                printf("could not recover from audio error: %s\n",
+                       snd_strerror(error));
+        }
+        return result;
+}
+
+static void render_into_area(struct AudioCallbackState* state,
+                             snd_pcm_channel_area_t const* areas,
+                             snd_pcm_uframes_t offset,
+                             int frame_count)
+{
+        // the access mode guarantees interleaved channels
+        void* const interleaved = static_cast<char*>(areas[0].addr) +
+                                  (areas[0].first + offset * areas[0].step) / 8;
+
+        snd_pcm_sframes_t delay_frames;
+        if (!OS_SUCCESS(snd_pcm_delay(state->pcm, &delay_frames))
+            || delay_frames < 0) {
+                delay_frames = 0;
+        }
+
+        uint64_t const buffer_micros =
+                clock_microseconds(state->clock) +
+                (uint64_t) 1000000 * delay_frames / 48000;
+
+        if (SND_PCM_FORMAT_S16 == state->format) {
+                audio_render_2chn_f32(buffer_micros, frame_count,
+                                      state->s16_client_buffer);
+                sample_convert_f32_to_s16(static_cast<int16_t*>(interleaved),
+                                          state->s16_client_buffer,
+                                          2 * frame_count);
+                return;
+        }
+
+        audio_render_2chn_f32(buffer_micros, frame_count,
+                              static_cast<float*>(interleaved));
+}
+
+static void* audio_callback(void* param)
+{
+        struct AudioCallbackState* state =
+                static_cast<struct AudioCallbackState*>(param);
+        snd_pcm_t* const pcm = state->pcm;
+
+        realtime_thread_setup("audio", 80, "MICROS_AUDIO_CPU");
+        frame_arena_prepare_thread();
+        tracking_allocator_prepare_thread();
+
+        bool must_start = true;
+        while (!state->must_stop.load()) {
+                snd_pcm_state_t const pcm_state = snd_pcm_state(pcm);
+                if (SND_PCM_STATE_XRUN == pcm_state) {
+                        if (!OS_SUCCESS(recover_stream(pcm, -EPIPE))) {
+                                break;
+                        }
+                        must_start = true;
+                } else if (SND_PCM_STATE_SUSPENDED == pcm_state) {
+                        if (!OS_SUCCESS(recover_stream(pcm, -ESTRPIPE))) {
+                                break;
+                        }
+                        must_start = true;
+                }
+
+                snd_pcm_sframes_t const avail = snd_pcm_avail_update(pcm);
+                if (avail < 0) {
+                        if (!OS_SUCCESS(recover_stream(pcm,
+                                                       static_cast<int>(avail)))) {
+                                break;
+                        }
+                        must_start = true;
+                        continue;
+                }
+
+                if (static_cast<snd_pcm_uframes_t>(avail) < state->period_frames) {
+                        if (must_start) {
+                                // the device is now full, start playing it
+                                must_start = false;
+                                int const err = snd_pcm_start(pcm);
+                                if (!OS_SUCCESS(err)) {
+                                        printf("could not start audio stream: %s\n",
+                                               snd_strerror(err));
+                                        break;
+                                }
+                        } else {
+                                int const err = snd_pcm_wait(pcm, 100);
+                                if (!OS_SUCCESS(err)
+                                    && !OS_SUCCESS(recover_stream(pcm, err))) {
+                                        break;
+                                }
+                        }
+                        continue;
+                }
+
+                snd_pcm_uframes_t remaining_frames = state->period_frames;
+                while (remaining_frames > 0) {
+                        snd_pcm_channel_area_t const* areas;
+                        snd_pcm_uframes_t offset;
+                        snd_pcm_uframes_t frame_count = remaining_frames;
+
+                        int const err = snd_pcm_mmap_begin(pcm, &areas, &offset,
+                                                           &frame_count);
+                        if (!OS_SUCCESS(err)) {
+                                recover_stream(pcm, err);
+                                must_start = true;
+                                break;
+                        }
+
+                        render_into_area(state, areas, offset,
+                                         static_cast<int>(frame_count));
+
+                        snd_pcm_sframes_t const committed =
+                                snd_pcm_mmap_commit(pcm, offset, frame_count);
+                        if (committed < 0 ||
+                            static_cast<snd_pcm_uframes_t>(committed) != frame_count) {
+                                recover_stream(pcm, committed < 0 ?
+                                               static_cast<int>(committed) : -EPIPE);
+                                must_start = true;
+                                break;
+                        }
+                        remaining_frames -= frame_count;
+                }
+        }
+
+        return NULL;
+}
+
+extern void close_stream()
+{
+        struct AudioCallbackState* state = main_stream;
+        if (state) {
+                state->must_stop.store(true);
+                pthread_join(state->thread, NULL);
+                snd_pcm_drop(state->pcm);
+                snd_pcm_close(state->pcm);
+                delete[] state->s16_client_buffer;
+                delete state;
+                main_stream = NULL;
+                printf("closed stream\n");
+        }
+}
+
+extern void open_stereo48khz_stream(struct Clock* clock)
+{
+        char const* device_name = getenv("MICROS_ALSA_DEVICE");
+        if (!device_name) {
+                device_name = "default";
+        }
+
+        snd_pcm_t* pcm;
+        BREAK_ON_ERROR(OS_SUCCESS(snd_pcm_open(&pcm, device_name,
+                                               SND_PCM_STREAM_PLAYBACK, 0))
+                       || FAIL_WITH("could not open audio device %s\n",
+                                    device_name));
+
+        unsigned int const audio_hz = 48000;
+        unsigned int rate = audio_hz;
+        snd_pcm_uframes_t period_frames = 512;
+        snd_pcm_uframes_t buffer_frames = 3 * period_frames;
+        snd_pcm_format_t format = SND_PCM_FORMAT_FLOAT;
+        {
+                snd_pcm_hw_params_t* params;
+                snd_pcm_hw_params_alloca(&params);
+
+                CLOSE_ON_ERROR(pcm,
+                        (OS_SUCCESS(snd_pcm_hw_params_any(pcm, params))
+                         && OS_SUCCESS(snd_pcm_hw_params_set_access
+                                       (pcm, params, SND_PCM_ACCESS_MMAP_INTERLEAVED))
+                         && OS_SUCCESS(snd_pcm_hw_params_set_channels
+                                       (pcm, params, 2))
+                         && OS_SUCCESS(snd_pcm_hw_params_set_rate_near
+                                       (pcm, params, &rate, 0)))
+                        || FAIL_WITH("could not configure audio device\n"));
+
+                if (!OS_SUCCESS(snd_pcm_hw_params_set_format(pcm, params, format))) {
+                        format = SND_PCM_FORMAT_S16;
+                        CLOSE_ON_ERROR(pcm,
+                                OS_SUCCESS(snd_pcm_hw_params_set_format(pcm, params, format))
+                                || FAIL_WITH("could not find a supported sample format\n"));
+                }
+
+                CLOSE_ON_ERROR(pcm, rate == audio_hz
+                               || FAIL_WITH("could not set sample rate to %u (got %u)\n",
+                                            audio_hz, rate));
+
+                CLOSE_ON_ERROR(pcm,
+                        (OS_SUCCESS(snd_pcm_hw_params_set_period_size_near
+                                    (pcm, params, &period_frames, 0))
+                         && OS_SUCCESS(snd_pcm_hw_params_set_buffer_size_near
+                                       (pcm, params, &buffer_frames))
+                         && OS_SUCCESS(snd_pcm_hw_params(pcm, params)))
+                        || FAIL_WITH("could not set audio buffer size\n"));
+        }
+
+        {
+                snd_pcm_sw_params_t* params;
+                snd_pcm_sw_params_alloca(&params);
+
+                CLOSE_ON_ERROR(pcm,
+                        (OS_SUCCESS(snd_pcm_sw_params_current(pcm, params))
+                         && OS_SUCCESS(snd_pcm_sw_params_set_start_threshold
+                                       (pcm, params, buffer_frames))
+                         && OS_SUCCESS(snd_pcm_sw_params_set_avail_min
+                                       (pcm, params, period_frames))
+                         && OS_SUCCESS(snd_pcm_sw_params(pcm, params)))
+                        || FAIL_WITH("could not configure audio scheduling\n"));
+        }
+
+        printf("initialized audio device %s: %u hz, %s samples, %lu frames period, %lu frames buffer\n",
+               device_name, rate, SND_PCM_FORMAT_S16 == format ? "16bit" : "float",
+               period_frames, buffer_frames);
+
+        struct AudioCallbackState* callback_state = new AudioCallbackState;
+        callback_state->clock = clock;
+        callback_state->pcm = pcm;
+        callback_state->period_frames = period_frames;
+        callback_state->format = format;
+        callback_state->s16_client_buffer = SND_PCM_FORMAT_S16 == format ?
+                                            new float[2 * period_frames] : NULL;
+        callback_state->must_stop.store(false);
+
+        if (0 != pthread_create(&callback_state->thread, NULL,
+                                audio_callback, callback_state)) {
+                printf("could not create audio thread\n");
+                delete[] callback_state->s16_client_buffer;
+                delete callback_state;
+                snd_pcm_close(pcm);
+                return;
+        }
+
+        main_stream = callback_state;
+        atexit(close_stream);
+}
@@ -0,0 +1 @@
+extern void open_stereo48khz_stream(struct Clock* clock);
@@ -0,0 +1,6 @@
+struct Clock;
+struct VirtualClock;
+
+extern void open_window(char const* title, bool prefers_fullscreen,
+                        struct Clock* clock,
+                        struct VirtualClock* virtual_clock);
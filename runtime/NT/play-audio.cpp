@@ -8,8 +8,6 @@
   http://msdn.microsoft.com/en-us/library/windows/desktop/dd316605(v=vs.85).aspx
 */
 
-#include <vector>
-
 #include <cstdio>
 
 #include <Audioclient.h>
@@ -17,7 +15,12 @@
 
 #include <micros/api.h>
 
-using std::vector;
+#include "../audio_render.h"
+#include "../audio_stats.h"
+#include "../clock.h"
+#include "../frame_arena.h"
+#include "../realtime_thread.h"
+#include "../tracking_allocator.h"
 
 
 #define OS_SUCCESS(call) (!FAILED(call))
@@ -60,6 +63,9 @@ static DWORD __stdcall audio_callback(LPVOID param)
 {
         HRESULT hr;
         struct AudioCallbackState* state = (struct AudioCallbackState*) param;
+        realtime_thread_setup("audio", 80, "MICROS_AUDIO_CPU");
+        frame_arena_prepare_thread();
+        tracking_allocator_prepare_thread();
         WaitForSingleObject(state->start_event, INFINITE);
 
         IAudioRenderClient* render_client;
@@ -82,12 +88,6 @@ static DWORD __stdcall audio_callback(LPVOID param)
         BREAK_ON_ERROR_WITH(OS_SUCCESS(hr)
                             || FAIL_WITH("could not get total frame count\n"), 1);
 
-        vector<double> left_client_buffer;
-        vector<double> right_client_buffer;
-
-        left_client_buffer.reserve(frame_count);
-        right_client_buffer.reserve(frame_count);
-
         UINT32 iterations = 0;
         UINT32 rendered_frame_count = 0;
         for(;;) {
@@ -114,24 +114,13 @@ static DWORD __stdcall audio_callback(LPVOID param)
                              frame_count,
                              &buffer);
                 if (hr == AUDCLNT_E_BUFFER_ERROR) {
+                        audio_stats_record_xrun();
                         continue;
                 }
                 BREAK_ON_ERROR_WITH(OS_SUCCESS(hr)
                                     || FAIL_WITH("could not get buffer [%d]\n",
                                                  iterations), 1);
 
-                struct {
-                        float* buffer;
-                        int stride;
-                        int frame_count;
-                } output[2] = {
-                        { (float*) buffer, 2, frame_count },
-                        { (float*) buffer + 1, 2, frame_count },
-                };
-
-                left_client_buffer.resize(frame_count);
-                right_client_buffer.resize(frame_count);
-
                 uint64_t const frame_micros =
                         (uint64_t) 1e6 * rendered_frame_count / 48000;
                 uint64_t const speaker_micros =
@@ -139,21 +128,10 @@ static DWORD __stdcall audio_callback(LPVOID param)
                 uint64_t const delay_to_speaker_in_micros =
                         frame_micros - speaker_micros;
                 uint64_t const buffer_micros =
-                        now_micros() + delay_to_speaker_in_micros;
+                        clock_microseconds(state->clock) +
+                        delay_to_speaker_in_micros;
 
-                render_next_2chn_48khz_audio
-                (buffer_micros,
-                 frame_count,
-                 &left_client_buffer.front(),
-                 &right_client_buffer.front());
-
-                for (UINT32 i = 0; i < frame_count; i++) {
-                        output[0].buffer[i * output[0].stride] = (float) left_client_buffer[i];
-                }
-
-                for (UINT32 i = 0; i < frame_count; i++) {
-                        output[1].buffer[i * output[1].stride] = (float) right_client_buffer[i];
-                }
+                audio_render_2chn_f32(buffer_micros, frame_count, (float*) buffer);
 
                 hr = render_client->ReleaseBuffer(frame_count, 0);
                 BREAK_ON_ERROR_WITH(OS_SUCCESS(hr)
@@ -3,7 +3,11 @@
 #include <micros/api.h>
 
 #include "../allocator_type.h"
+#include "../audio_render.h"
 #include "../clock.h"
+#include "../offline_render.h"
+#include "../tracking_allocator.h"
+#include "../virtual_clock.h"
 #include "window.h"
 
 extern void open_stereo48khz_stream(struct Clock* clock);
@@ -19,17 +23,35 @@ static void std_free(struct Allocator* self, void* ptr)
 }
 
 static struct Allocator std_allocator = { std_alloc, std_free };
+static struct TrackingAllocator tracked_std_allocator;
 
 static struct Clock* clock;
+static struct VirtualClock* virtual_clock;
 
 void runtime_init ()
 {
-        clock_init(&clock, &std_allocator);
+        struct Allocator* allocator =
+                tracking_allocator_wrap(&tracked_std_allocator, &std_allocator,
+                                        "runtime", false);
+
+        clock_init(&clock, allocator);
+        audio_render_init(clock, allocator);
+        if (run_offline_render(clock)) {
+                return;
+        }
+        if (virtual_clock_is_requested()) {
+                virtual_clock_init(&virtual_clock, allocator, clock);
+                audio_render_follow(virtual_clock);
+        }
+        audio_render_start_lookahead(allocator);
         open_stereo48khz_stream(clock);
-        open_window("main", false);
+        open_window("main", false, clock, virtual_clock);
 }
 
 uint64_t now_micros()
 {
+        if (virtual_clock) {
+                return virtual_clock_micros(virtual_clock);
+        }
         return clock_microseconds(clock);
 }
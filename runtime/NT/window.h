@@ -1 +1,6 @@
-void open_window(const char* title, bool prefers_fullscreen);
+struct Clock;
+struct VirtualClock;
+
+void open_window(const char* title, bool prefers_fullscreen,
+                 struct Clock* clock,
+                 struct VirtualClock* virtual_clock);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+struct Allocator;
+struct Clock;
+struct VirtualClock;
+
+/**
+ * reads the rendering options, such as MICROS_AUDIO_BLOCK_FRAMES to
+ * always render in blocks of the same size. Renders are timed with
+ * clock, and their statistics summarized on exit.
+ */
+extern void audio_render_init(struct Clock* clock,
+                              struct Allocator* allocator);
+
+/**
+ * for realtime streams: starts the producer thread when
+ * MICROS_AUDIO_LOOKAHEAD_FRAMES asks for frames to be rendered ahead
+ * of the device. The lookahead should be larger than the device's
+ * period.
+ */
+extern void audio_render_start_lookahead(struct Allocator* allocator);
+
+/**
+ * for realtime streams: maps the device's times to the demo time of
+ * virtual_clock, rendering silence while it is paused.
+ */
+extern void audio_render_follow(struct VirtualClock* virtual_clock);
+
+/**
+ * renders the next frames of the demo's soundtrack, as 48khz
+ * interleaved stereo floats.
+ *
+ * This is what the audio backends call from their device callback.
+ */
+extern void audio_render_2chn_f32(uint64_t time_micros,
+                                  int frame_count,
+                                  float interleaved[/*2*frame_count*/]);
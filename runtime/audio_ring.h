@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+struct Allocator;
+
+/**
+ * Lock-free ring of interleaved stereo float frames, for one producer
+ * thread and one consumer thread.
+ *
+ * Each side only ever advances its own position, which the other side
+ * reads to know how many frames it may access.
+ */
+struct AudioRing {
+        float* samples;
+        uint64_t capacity_frames; // a power of two
+        std::atomic<uint64_t> write_position;
+        std::atomic<uint64_t> read_position;
+};
+
+extern int audio_ring_init(struct AudioRing* ring,
+                           struct Allocator* allocator,
+                           uint64_t min_capacity_frames);
+extern void audio_ring_deinit(struct AudioRing* ring,
+                              struct Allocator* allocator);
+
+/// consumer: frames ready to be read
+extern uint64_t audio_ring_readable(struct AudioRing const* ring);
+
+/// consumer: copies out up to frame_count frames, returns the count read
+extern int audio_ring_read(struct AudioRing* ring,
+                           float interleaved[/*2*frame_count*/],
+                           int frame_count);
+
+/// producer: frames which may be written
+extern uint64_t audio_ring_writable(struct AudioRing const* ring);
+
+/**
+ * producer: gives access to the next contiguous region of the ring, of
+ * at most max_frame_count frames, to render into.
+ *
+ * @return the size of the region in frames
+ */
+extern int audio_ring_write_region(struct AudioRing* ring,
+                                   float** interleaved,
+                                   int max_frame_count);
+
+/// producer: publishes the frames written into the region
+extern void audio_ring_commit(struct AudioRing* ring, int frame_count);
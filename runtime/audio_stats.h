@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Statistics about how close audio rendering comes to its deadlines,
+ * gathered from the audio threads without locking.
+ *
+ * The load of a render is the time it took, relative to the duration
+ * of the audio it produced: above 1.0 the device eventually starves.
+ */
+
+/// records a render of frame_count frames, which took duration_micros
+extern void audio_stats_record_render(uint64_t duration_micros,
+                                      int frame_count);
+
+/// records a device under/overrun
+extern void audio_stats_record_xrun();
+
+/// records a device callback which found the lookahead ring short
+extern void audio_stats_record_underrun();
+
+/// prints the statistics gathered so far
+extern void audio_stats_print_summary();
@@ -2,12 +2,28 @@
 
 struct Allocator;
 
+enum ClockSource {
+        CLOCK_SOURCE_OS, // the operating system's monotonic clock
+        CLOCK_SOURCE_TSC, // the cpu's time stamp counter
+};
+
 struct Clock {
         struct Allocator* allocator;
+        enum ClockSource source;
         /**
          * numerator/denominator to convert ticks to microseconds
          */
         uint64_t microseconds_per_tick[2];
+        /**
+         * the same ratio as multiplier / 2^shift, rounded up, to convert
+         * with a single multiply-shift. Conversions are exact for ticks
+         * up to exact_tick_limit and, for ticks shorter than a
+         * microsecond, at most 2us ahead beyond. A limit under ten years
+         * of uptime is printed at init.
+         */
+        uint64_t microseconds_per_tick_multiplier;
+        int microseconds_per_tick_shift;
+        uint64_t exact_tick_limit;
 };
 
 extern int clock_init_base(
@@ -0,0 +1,473 @@
+/**
+ * \file
+ *
+ * Delegates audio rendering to the demo's entry points.
+ *
+ * Both entry points are optional: the runtime provides default
+ * definitions, which the linker only uses when the demo does not
+ * define its own. The float entry point renders directly into the
+ * device's buffer, while the double entry point requires converting
+ * its output.
+ *
+ * In producer mode (MICROS_AUDIO_LOOKAHEAD_FRAMES) the entry points are
+ * called ahead of time from a dedicated thread, which fills a ring
+ * that the device callback then only copies out from. Spikes in the
+ * demo's synth are absorbed by the lookahead rather than turning into
+ * glitches.
+ *
+ * With MICROS_AUDIO_BLOCK_FRAMES the entry points are always called for
+ * that many frames, into a 32 bytes aligned buffer, whatever the
+ * device's period. Frames rendered beyond what the device asked for
+ * are carried over to the next call.
+ *
+ * Every render is timed against the duration of the audio it produces,
+ * see audio_stats.h
+ *
+ * Device times are converted to demo time when following a virtual
+ * clock, block by block, so that blocks follow its rate. Pausing it
+ * discards the frames carried over.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // memcpy, memset
+#include <thread>
+
+#include <micros/api.h>
+
+#include "../allocator.h"
+#include "../audio_render.h"
+#include "../audio_ring.h"
+#include "../audio_stats.h"
+#include "../clock.h"
+#include "../frame_arena.h"
+#include "../pool_allocator.h"
+#include "../realtime_thread.h"
+#include "../sample_convert.h"
+#include "../tracking_allocator.h"
+#include "../virtual_clock.h"
+
+static struct Clock* audio_render_clock;
+static struct VirtualClock* audio_render_virtual_clock;
+
+static uint64_t audio_frames_to_micros(uint64_t frame_count)
+{
+        return (uint64_t) 1000000 * frame_count / 48000;
+}
+
+/// demo time elapsed over frame_count frames, at the current rate
+static uint64_t audio_frames_to_demo_micros(uint64_t frame_count)
+{
+        uint64_t const micros = audio_frames_to_micros(frame_count);
+        struct VirtualClock const* virtual_clock = audio_render_virtual_clock;
+        if (!virtual_clock) {
+                return micros;
+        }
+        return static_cast<uint64_t>(micros *
+                                     virtual_clock_rate(virtual_clock));
+}
+
+/// demo time of the frame played frame_offset frames after device_micros
+static uint64_t audio_device_to_demo_micros(uint64_t device_micros,
+                int frame_offset)
+{
+        uint64_t const micros = device_micros +
+                                audio_frames_to_micros(frame_offset);
+        struct VirtualClock const* virtual_clock = audio_render_virtual_clock;
+        return virtual_clock ? virtual_clock_map(virtual_clock, micros, NULL) :
+               micros;
+}
+
+static void render_f32_with_f64_entry_point(uint64_t time_micros,
+                int const sample_count,
+                float interleaved[])
+{
+        int const chunk_frame_count = 1024;
+        double left_client_buffer[chunk_frame_count];
+        double right_client_buffer[chunk_frame_count];
+
+        for (int offset = 0; offset < sample_count;
+             offset += chunk_frame_count) {
+                int const frame_count = sample_count - offset < chunk_frame_count ?
+                                        sample_count - offset : chunk_frame_count;
+
+                render_next_2chn_48khz_audio
+                (time_micros + audio_frames_to_demo_micros(offset),
+                 frame_count,
+                 left_client_buffer,
+                 right_client_buffer);
+
+                sample_convert_f64_planar_to_f32(&interleaved[2 * offset],
+                                                 left_client_buffer,
+                                                 right_client_buffer,
+                                                 frame_count);
+        }
+}
+
+static void render_silence(int const sample_count,
+                           double left[],
+                           double right[])
+{
+        for (int i = 0; i < sample_count; i++) {
+                left[i] = 0.0;
+                right[i] = 0.0;
+        }
+}
+
+#if defined(_MSC_VER)
+
+// Visual Studio has no weak symbols, the defaults are aliased to the
+// entry points' decorated names instead.
+
+extern void default_render_next_2chn_48khz_audio_f32(uint64_t time_micros,
+                int const sample_count,
+                float interleaved[])
+{
+        render_f32_with_f64_entry_point(time_micros, sample_count, interleaved);
+}
+
+extern void default_render_next_2chn_48khz_audio(uint64_t time_micros,
+                int const sample_count,
+                double left[],
+                double right[])
+{
+        render_silence(sample_count, left, right);
+}
+
+#if defined(_M_X64)
+#pragma comment(linker, "/alternatename:?render_next_2chn_48khz_audio_f32@@YAX_KHQEAM@Z=?default_render_next_2chn_48khz_audio_f32@@YAX_KHQEAM@Z")
+#pragma comment(linker, "/alternatename:?render_next_2chn_48khz_audio@@YAX_KHQEAN1@Z=?default_render_next_2chn_48khz_audio@@YAX_KHQEAN1@Z")
+#else
+#pragma comment(linker, "/alternatename:?render_next_2chn_48khz_audio_f32@@YAX_KHQAM@Z=?default_render_next_2chn_48khz_audio_f32@@YAX_KHQAM@Z")
+#pragma comment(linker, "/alternatename:?render_next_2chn_48khz_audio@@YAX_KHQAN1@Z=?default_render_next_2chn_48khz_audio@@YAX_KHQAN1@Z")
+#endif
+
+#else
+
+extern __attribute__((weak))
+void render_next_2chn_48khz_audio_f32(uint64_t time_micros,
+                                      int const sample_count,
+                                      float interleaved[])
+{
+        render_f32_with_f64_entry_point(time_micros, sample_count, interleaved);
+}
+
+extern __attribute__((weak))
+void render_next_2chn_48khz_audio(uint64_t time_micros,
+                                  int const sample_count,
+                                  double left[],
+                                  double right[])
+{
+        render_silence(sample_count, left, right);
+}
+
+#endif
+
+static struct PoolAllocator* audio_pool;
+static struct TrackingAllocator audio_pool_tracking;
+static struct Allocator* audio_pool_allocator;
+
+extern struct Allocator* audio_allocator()
+{
+        return audio_pool_allocator;
+}
+
+/// calls the demo, then reclaims the scratch memory it used
+static void render_entry_point(uint64_t time_micros,
+                               int frame_count,
+                               float interleaved[])
+{
+        if (audio_pool) {
+                pool_allocator_claim(audio_pool);
+        }
+        tracking_allocator_begin_audio();
+        render_next_2chn_48khz_audio_f32(time_micros, frame_count, interleaved);
+        tracking_allocator_end_audio();
+        frame_arena_reset_thread();
+}
+
+struct AudioBlockAdapter {
+        int block_frame_count;
+        float* block; // aligned
+        void* block_allocation;
+        int carry_offset; // first frame of the block not yet played
+};
+
+static struct AudioBlockAdapter* audio_block_adapter;
+
+static bool is_aligned_for_blocks(float const* samples)
+{
+        return reinterpret_cast<uintptr_t>(samples) % 32 == 0;
+}
+
+/// @param device_micros when the first frame gets played
+static void render_blocks(struct AudioBlockAdapter* adapter,
+                          uint64_t device_micros,
+                          int frame_count,
+                          float interleaved[])
+{
+        int const block_frame_count = adapter->block_frame_count;
+
+        int const carry_count = block_frame_count - adapter->carry_offset;
+        int done_count = carry_count < frame_count ? carry_count : frame_count;
+        memcpy(interleaved, &adapter->block[2 * adapter->carry_offset],
+               2 * done_count * sizeof interleaved[0]);
+        adapter->carry_offset += done_count;
+
+        while (done_count < frame_count) {
+                uint64_t const block_micros =
+                        audio_device_to_demo_micros(device_micros, done_count);
+                float* const output = &interleaved[2 * done_count];
+                int const remaining_count = frame_count - done_count;
+
+                if (remaining_count >= block_frame_count &&
+                    is_aligned_for_blocks(output)) {
+                        render_entry_point(block_micros, block_frame_count,
+                                           output);
+                        done_count += block_frame_count;
+                        continue;
+                }
+
+                render_entry_point(block_micros, block_frame_count,
+                                   adapter->block);
+                int const copy_count = remaining_count < block_frame_count ?
+                                       remaining_count : block_frame_count;
+                memcpy(output, adapter->block, 2 * copy_count * sizeof output[0]);
+                adapter->carry_offset = copy_count;
+                done_count += copy_count;
+        }
+}
+
+/**
+ * renders frames, in the blocks required by the options
+ *
+ * @param time_micros when the first frame gets played, in device time
+ */
+static void render_frames(uint64_t time_micros,
+                          int frame_count,
+                          float interleaved[])
+{
+        struct AudioBlockAdapter* adapter = audio_block_adapter;
+        struct VirtualClock* const virtual_clock = audio_render_virtual_clock;
+        if (virtual_clock) {
+                bool is_paused;
+                virtual_clock_map(virtual_clock, time_micros, &is_paused);
+                if (is_paused) {
+                        memset(interleaved, 0,
+                               2 * frame_count * sizeof interleaved[0]);
+                        // resumes on a fresh block, not on stale frames
+                        if (adapter) {
+                                adapter->carry_offset =
+                                        adapter->block_frame_count;
+                        }
+                        return;
+                }
+        }
+
+        struct Clock* const clock = audio_render_clock;
+        uint64_t const start_ticks = clock_ticks(clock);
+
+        if (adapter) {
+                render_blocks(adapter, time_micros, frame_count, interleaved);
+        } else {
+                render_entry_point(audio_device_to_demo_micros(time_micros, 0),
+                                   frame_count, interleaved);
+        }
+
+        audio_stats_record_render(
+                clock_ticks_to_microseconds(clock,
+                                            clock_ticks(clock) - start_ticks),
+                frame_count);
+}
+
+extern void audio_render_init(struct Clock* clock,
+                              struct Allocator* allocator)
+{
+        audio_render_clock = clock;
+        atexit(audio_stats_print_summary);
+
+        char const* pool_bytes = getenv("MICROS_AUDIO_POOL_BYTES");
+        long long const pool_capacity = pool_bytes ? atoll(pool_bytes) : 4 << 20;
+        if (pool_capacity > 0 && pool_capacity < POOL_ALLOCATOR_MIN_CAPACITY) {
+                printf("MICROS_AUDIO_POOL_BYTES should be at least %d bytes, "
+                       "a page per size class\n", POOL_ALLOCATOR_MIN_CAPACITY);
+        } else if (pool_capacity > 0) {
+                // room for the tracking header, so that blocks of every
+                // class still fit their full size
+                struct PoolAllocator* pool = new PoolAllocator;
+                if (pool_allocator_init(pool, allocator,
+                                        static_cast<size_t>(pool_capacity),
+                                        tracking_allocator_overhead())) {
+                        printf("could not allocate audio pool\n");
+                        delete pool;
+                } else {
+                        audio_pool = pool;
+                        audio_pool_allocator = tracking_allocator_wrap(
+                                                       &audio_pool_tracking, &pool->allocator,
+                                                       "audio pool", true);
+                }
+        }
+
+        char const* block_frames = getenv("MICROS_AUDIO_BLOCK_FRAMES");
+        if (!block_frames || !block_frames[0]) {
+                return;
+        }
+
+        int const block_frame_count = atoi(block_frames);
+        if (block_frame_count < 16 || block_frame_count > 4096 ||
+            (block_frame_count & (block_frame_count - 1))) {
+                printf("MICROS_AUDIO_BLOCK_FRAMES should be a power of two between 16 and 4096\n");
+                return;
+        }
+
+        size_t const block_size = 2 * block_frame_count * sizeof(float);
+        void* block_allocation = allocator_alloc(allocator, block_size + 32);
+        if (!block_allocation) {
+                printf("could not allocate audio block\n");
+                return;
+        }
+
+        struct AudioBlockAdapter* adapter = new AudioBlockAdapter;
+        adapter->block_frame_count = block_frame_count;
+        adapter->block_allocation = block_allocation;
+        adapter->block = reinterpret_cast<float*>(
+                                 (reinterpret_cast<uintptr_t>(block_allocation) + 31) &
+                                 ~static_cast<uintptr_t>(31));
+        adapter->carry_offset = block_frame_count;
+
+        audio_block_adapter = adapter;
+        printf("rendering audio in blocks of %d frames\n", block_frame_count);
+}
+
+struct AudioProducer {
+        struct Allocator* allocator;
+        struct AudioRing ring;
+        uint64_t lookahead_frames;
+        /**
+         * time at which the first frame of the ring gets played, as
+         * last observed by the device callback.
+         */
+        std::atomic<uint64_t> origin_micros;
+        std::atomic<bool> has_origin;
+        std::atomic<bool> must_stop;
+        std::thread thread;
+};
+
+static struct AudioProducer* audio_producer;
+
+static void audio_producer_loop(struct AudioProducer* producer)
+{
+        // render in chunks, rather than reacting to every freed frame
+        uint64_t const chunk_frame_count = producer->lookahead_frames < 256 ?
+                                           producer->lookahead_frames : 256;
+        auto const idle_duration = std::chrono::milliseconds(1);
+
+        // lower than the device thread, which may then preempt us
+        realtime_thread_setup("audio producer", 70,
+                              "MICROS_AUDIO_PRODUCER_CPU");
+        frame_arena_prepare_thread();
+        tracking_allocator_prepare_thread();
+
+        while (!producer->must_stop.load()) {
+                if (!producer->has_origin.load(std::memory_order_acquire)) {
+                        // wait for the device to tell us when it plays
+                        std::this_thread::sleep_for(idle_duration);
+                        continue;
+                }
+
+                struct AudioRing* ring = &producer->ring;
+                uint64_t const fill = ring->capacity_frames - audio_ring_writable(ring);
+                if (fill + chunk_frame_count > producer->lookahead_frames) {
+                        std::this_thread::sleep_for(idle_duration);
+                        continue;
+                }
+
+                uint64_t const write_position =
+                        ring->write_position.load(std::memory_order_relaxed);
+                float* region;
+                int const frame_count = audio_ring_write_region(
+                                                ring, &region,
+                                                static_cast<int>(producer->lookahead_frames - fill));
+                uint64_t const time_micros =
+                        producer->origin_micros.load(std::memory_order_acquire) +
+                        audio_frames_to_micros(write_position);
+
+                render_frames(time_micros, frame_count, region);
+                audio_ring_commit(ring, frame_count);
+        }
+}
+
+static void audio_render_stop_lookahead()
+{
+        struct AudioProducer* producer = audio_producer;
+        if (producer) {
+                producer->must_stop.store(true);
+                producer->thread.join();
+                audio_producer = NULL;
+                audio_ring_deinit(&producer->ring, producer->allocator);
+                delete producer;
+        }
+}
+
+extern void audio_render_start_lookahead(struct Allocator* allocator)
+{
+        char const* lookahead = getenv("MICROS_AUDIO_LOOKAHEAD_FRAMES");
+        if (!lookahead || atoi(lookahead) <= 0) {
+                return;
+        }
+
+        struct AudioProducer* producer = new AudioProducer;
+        producer->allocator = allocator;
+        producer->lookahead_frames = atoi(lookahead);
+        if (audio_ring_init(&producer->ring, allocator,
+                            producer->lookahead_frames)) {
+                printf("could not allocate audio lookahead\n");
+                delete producer;
+                return;
+        }
+        producer->origin_micros.store(0);
+        producer->has_origin.store(false);
+        producer->must_stop.store(false);
+        producer->thread = std::thread(audio_producer_loop, producer);
+
+        audio_producer = producer;
+        atexit(audio_render_stop_lookahead);
+        printf("rendering audio %llu frames ahead\n",
+               static_cast<unsigned long long>(producer->lookahead_frames));
+}
+
+extern void audio_render_follow(struct VirtualClock* virtual_clock)
+{
+        audio_render_virtual_clock = virtual_clock;
+}
+
+extern void audio_render_2chn_f32(uint64_t time_micros,
+                                  int frame_count,
+                                  float interleaved[])
+{
+        struct AudioProducer* producer = audio_producer;
+        if (!producer) {
+                render_frames(time_micros, frame_count, interleaved);
+                return;
+        }
+
+        struct AudioRing* ring = &producer->ring;
+        int const read_count = audio_ring_read(ring, interleaved, frame_count);
+        if (read_count < frame_count && producer->has_origin.load()) {
+                audio_stats_record_underrun();
+        }
+        for (int i = 2 * read_count; i < 2 * frame_count; i++) {
+                interleaved[i] = 0.0f;
+        }
+
+        // the next frame of the ring plays right after this buffer,
+        // including any silence we had to insert
+        uint64_t const next_read_position =
+                ring->read_position.load(std::memory_order_relaxed);
+        producer->origin_micros.store(time_micros +
+                                      audio_frames_to_micros(frame_count) -
+                                      audio_frames_to_micros(next_read_position),
+                                      std::memory_order_release);
+        producer->has_origin.store(true, std::memory_order_release);
+}
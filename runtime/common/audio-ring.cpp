@@ -0,0 +1,104 @@
+#include <cstring> // memcpy
+
+#include "../allocator.h"
+#include "../audio_ring.h"
+
+extern int audio_ring_init(struct AudioRing* ring,
+                           struct Allocator* allocator,
+                           uint64_t min_capacity_frames)
+{
+        uint64_t capacity_frames = 1;
+        while (capacity_frames < min_capacity_frames) {
+                capacity_frames *= 2;
+        }
+
+        float* samples = static_cast<float*>(
+                                 allocator_alloc(allocator,
+                                                 static_cast<size_t>(2 * capacity_frames * sizeof samples[0])));
+        if (!samples) {
+                return -1;
+        }
+
+        ring->samples = samples;
+        ring->capacity_frames = capacity_frames;
+        ring->write_position.store(0);
+        ring->read_position.store(0);
+
+        return 0;
+}
+
+extern void audio_ring_deinit(struct AudioRing* ring,
+                              struct Allocator* allocator)
+{
+        allocator_free(allocator, ring->samples);
+        ring->samples = NULL;
+        ring->capacity_frames = 0;
+}
+
+extern uint64_t audio_ring_readable(struct AudioRing const* ring)
+{
+        return ring->write_position.load(std::memory_order_acquire) -
+               ring->read_position.load(std::memory_order_relaxed);
+}
+
+extern int audio_ring_read(struct AudioRing* ring,
+                           float interleaved[],
+                           int frame_count)
+{
+        uint64_t const read_position =
+                ring->read_position.load(std::memory_order_relaxed);
+        uint64_t const readable = audio_ring_readable(ring);
+        int const read_count = readable < static_cast<uint64_t>(frame_count) ?
+                               static_cast<int>(readable) : frame_count;
+
+        uint64_t const mask = ring->capacity_frames - 1;
+        uint64_t const first_frame = read_position & mask;
+        uint64_t const first_count =
+                ring->capacity_frames - first_frame < static_cast<uint64_t>(read_count) ?
+                ring->capacity_frames - first_frame : read_count;
+
+        memcpy(interleaved, &ring->samples[2 * first_frame],
+               static_cast<size_t>(2 * first_count * sizeof interleaved[0]));
+        memcpy(&interleaved[2 * first_count], ring->samples,
+               static_cast<size_t>(2 * (read_count - first_count) * sizeof interleaved[0]));
+
+        ring->read_position.store(read_position + read_count,
+                                  std::memory_order_release);
+
+        return read_count;
+}
+
+extern uint64_t audio_ring_writable(struct AudioRing const* ring)
+{
+        return ring->capacity_frames -
+               (ring->write_position.load(std::memory_order_relaxed) -
+                ring->read_position.load(std::memory_order_acquire));
+}
+
+extern int audio_ring_write_region(struct AudioRing* ring,
+                                   float** interleaved,
+                                   int max_frame_count)
+{
+        uint64_t const write_frame =
+                ring->write_position.load(std::memory_order_relaxed) &
+                (ring->capacity_frames - 1);
+
+        uint64_t region_count = audio_ring_writable(ring);
+        if (region_count > ring->capacity_frames - write_frame) {
+                region_count = ring->capacity_frames - write_frame;
+        }
+        if (region_count > static_cast<uint64_t>(max_frame_count)) {
+                region_count = max_frame_count;
+        }
+
+        *interleaved = &ring->samples[2 * write_frame];
+
+        return static_cast<int>(region_count);
+}
+
+extern void audio_ring_commit(struct AudioRing* ring, int frame_count)
+{
+        ring->write_position.store(
+                ring->write_position.load(std::memory_order_relaxed) + frame_count,
+                std::memory_order_release);
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <cstdio>
+
+#include <micros/api.h>
+
+#include "../audio_stats.h"
+
+static int const LOAD_BUCKET_COUNT = sizeof AudioStats::load_histogram /
+                                     sizeof AudioStats::load_histogram[0];
+static int const LOAD_BUCKETS_PER_UNIT = 8;
+
+static struct {
+        std::atomic<uint64_t> render_count;
+        std::atomic<uint64_t> late_render_count;
+        std::atomic<uint64_t> xrun_count;
+        std::atomic<uint64_t> underrun_count;
+        std::atomic<uint64_t> max_load_permille;
+        std::atomic<uint64_t> load_histogram[LOAD_BUCKET_COUNT];
+} audio_stats;
+
+extern void audio_stats_record_render(uint64_t duration_micros,
+                                      int frame_count)
+{
+        if (frame_count <= 0) {
+                return;
+        }
+
+        uint64_t const period_micros = (uint64_t) 1000000 * frame_count / 48000;
+        uint64_t const load_permille =
+                period_micros ? 1000 * duration_micros / period_micros : 0;
+
+        uint64_t bucket = LOAD_BUCKETS_PER_UNIT * load_permille / 1000;
+        if (bucket >= LOAD_BUCKET_COUNT) {
+                bucket = LOAD_BUCKET_COUNT - 1;
+        }
+
+        audio_stats.render_count.fetch_add(1, std::memory_order_relaxed);
+        audio_stats.load_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+        if (duration_micros > period_micros) {
+                audio_stats.late_render_count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint64_t max_load = audio_stats.max_load_permille.load(
+                                    std::memory_order_relaxed);
+        while (load_permille > max_load &&
+               !audio_stats.max_load_permille.compare_exchange_weak(
+                       max_load, load_permille, std::memory_order_relaxed)) {
+        }
+}
+
+extern void audio_stats_record_xrun()
+{
+        audio_stats.xrun_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern void audio_stats_record_underrun()
+{
+        audio_stats.underrun_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern void query_audio_stats(struct AudioStats* stats)
+{
+        stats->render_count = audio_stats.render_count.load(std::memory_order_relaxed);
+        stats->late_render_count =
+                audio_stats.late_render_count.load(std::memory_order_relaxed);
+        stats->xrun_count = audio_stats.xrun_count.load(std::memory_order_relaxed);
+        stats->underrun_count =
+                audio_stats.underrun_count.load(std::memory_order_relaxed);
+        stats->max_load =
+                audio_stats.max_load_permille.load(std::memory_order_relaxed) / 1000.0;
+        for (int i = 0; i < LOAD_BUCKET_COUNT; i++) {
+                stats->load_histogram[i] =
+                        audio_stats.load_histogram[i].load(std::memory_order_relaxed);
+        }
+}
+
+extern void audio_stats_print_summary()
+{
+        struct AudioStats stats;
+        query_audio_stats(&stats);
+        if (0 == stats.render_count) {
+                return;
+        }
+
+        printf("audio: %llu renders, %llu late, max load %.2f, %llu xruns, %llu underruns\n",
+               static_cast<unsigned long long>(stats.render_count),
+               static_cast<unsigned long long>(stats.late_render_count),
+               stats.max_load,
+               static_cast<unsigned long long>(stats.xrun_count),
+               static_cast<unsigned long long>(stats.underrun_count));
+
+        for (int i = 0; i < LOAD_BUCKET_COUNT; i++) {
+                if (0 == stats.load_histogram[i]) {
+                        continue;
+                }
+
+                double const load_min = static_cast<double>(i) / LOAD_BUCKETS_PER_UNIT;
+                if (i == LOAD_BUCKET_COUNT - 1) {
+                        printf("  load >= %.3f: %llu\n", load_min,
+                               static_cast<unsigned long long>(stats.load_histogram[i]));
+                } else {
+                        printf("  load %.3f-%.3f: %llu\n", load_min,
+                               load_min + 1.0 / LOAD_BUCKETS_PER_UNIT,
+                               static_cast<unsigned long long>(stats.load_histogram[i]));
+                }
+        }
+}
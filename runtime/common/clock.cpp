@@ -1,7 +1,121 @@
+#include <cstdio>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
 #include "../clock.h"
 #include "../allocator.h"
 #include "../clock_type.h"
 
+/// full 128 bits product of a and b
+static void clock_multiply_128(uint64_t a, uint64_t b,
+                               uint64_t* high, uint64_t* low)
+{
+#if defined(__SIZEOF_INT128__)
+        unsigned __int128 const product = static_cast<unsigned __int128>(a) * b;
+        *high = static_cast<uint64_t>(product >> 64);
+        *low = static_cast<uint64_t>(product);
+#elif defined(_MSC_VER) && defined(_M_X64)
+        *low = _umul128(a, b, high);
+#else
+        uint64_t const a_lo = a & 0xffffffff;
+        uint64_t const a_hi = a >> 32;
+        uint64_t const b_lo = b & 0xffffffff;
+        uint64_t const b_hi = b >> 32;
+
+        uint64_t const lo_lo = a_lo * b_lo;
+        uint64_t const hi_lo = a_hi * b_lo;
+        uint64_t const lo_hi = a_lo * b_hi;
+        uint64_t const hi_hi = a_hi * b_hi;
+
+        uint64_t const middle = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+        *high = hi_hi + (hi_lo >> 32) + (middle >> 32);
+        *low = (middle << 32) | (lo_lo & 0xffffffff);
+#endif
+}
+
+static uint64_t clock_gcd(uint64_t a, uint64_t b)
+{
+        while (b) {
+                uint64_t const r = a % b;
+                a = b;
+                b = r;
+        }
+        return a;
+}
+
+/**
+ * finds the largest shift for which ceil(numerator * 2^shift /
+ * denominator) fits in 64 bits, by long division.
+ *
+ * @return the rounding error of the multiplier, multiplier *
+ * denominator - numerator * 2^shift, within [0, denominator)
+ */
+static uint64_t clock_normalize_ratio(uint64_t numerator,
+                                      uint64_t denominator,
+                                      uint64_t* multiplierp,
+                                      int* shiftp)
+{
+        uint64_t multiplier = numerator / denominator;
+        uint64_t remainder = numerator % denominator;
+        int shift = 0;
+        while (!(multiplier >> 63) && shift < 127) {
+                bool const carry = remainder >> 63;
+                remainder <<= 1;
+                multiplier <<= 1;
+                if (carry || remainder >= denominator) {
+                        remainder -= denominator;
+                        multiplier |= 1;
+                }
+                shift++;
+        }
+
+        if (0 == remainder) {
+                *multiplierp = multiplier;
+                *shiftp = shift;
+                return 0;
+        }
+        if (~multiplier) {
+                *multiplierp = multiplier + 1;
+                *shiftp = shift;
+                return denominator - remainder;
+        }
+        // rounding up carried out of 64 bits: 2^64 / 2^shift is exactly
+        // 2^63 / 2^(shift - 1)
+        *multiplierp = static_cast<uint64_t>(1) << 63;
+        *shiftp = shift - 1;
+        return (denominator - remainder) / 2;
+}
+
+/**
+ * the largest ticks for which ticks * error < 2^shift, so that the
+ * error of the multiplier never adds up to a whole microsecond
+ */
+static uint64_t clock_exact_tick_limit(uint64_t error, int shift)
+{
+        if (0 == error) {
+                return ~static_cast<uint64_t>(0);
+        }
+
+        // floor((2^shift - 1) / error), by long division
+        uint64_t limit = 0;
+        uint64_t remainder = 0;
+        for (int i = 0; i < shift; i++) {
+                if (limit >> 63) {
+                        return ~static_cast<uint64_t>(0);
+                }
+                bool const carry = remainder >> 63;
+                remainder = remainder << 1 | 1;
+                limit <<= 1;
+                if (carry || remainder >= error) {
+                        remainder -= error;
+                        limit |= 1;
+                }
+        }
+        return limit;
+}
+
 extern int clock_init_base(
         struct Clock** clockp,
         struct Allocator* allocator,
@@ -15,8 +129,28 @@ extern int clock_init_base(
         }
 
         clock->allocator = allocator;
-        clock->microseconds_per_tick[0] = numerator;
-        clock->microseconds_per_tick[1] = denominator;
+        clock->source = CLOCK_SOURCE_OS;
+        uint64_t const gcd = clock_gcd(numerator, denominator);
+        clock->microseconds_per_tick[0] = numerator / gcd;
+        clock->microseconds_per_tick[1] = denominator / gcd;
+        uint64_t const error =
+                clock_normalize_ratio(clock->microseconds_per_tick[0],
+                                      clock->microseconds_per_tick[1],
+                                      &clock->microseconds_per_tick_multiplier,
+                                      &clock->microseconds_per_tick_shift);
+        clock->exact_tick_limit =
+                clock_exact_tick_limit(error, clock->microseconds_per_tick_shift);
+
+        // ticks count from boot on most clocks, so the limit is an uptime
+        double const limit_seconds =
+                static_cast<double>(clock->exact_tick_limit) *
+                clock->microseconds_per_tick[0] /
+                clock->microseconds_per_tick[1] / 1e6;
+        double const ten_years_seconds = 10 * 365.25 * 24 * 3600;
+        if (limit_seconds < ten_years_seconds) {
+                printf("clock: conversions to microseconds are exact for "
+                       "%.1f days of uptime\n", limit_seconds / 86400);
+        }
 
         *clockp = clock;
 
@@ -33,8 +167,15 @@ extern void clock_deinit(struct Clock** clockp)
 extern uint64_t clock_ticks_to_microseconds(struct Clock const * clock,
                 uint64_t ticks)
 {
-        return clock->microseconds_per_tick[0] * ticks /
-               clock->microseconds_per_tick[1];
+        uint64_t high, low;
+        clock_multiply_128(ticks, clock->microseconds_per_tick_multiplier,
+                           &high, &low);
+
+        int const shift = clock->microseconds_per_tick_shift;
+        if (shift >= 64) {
+                return high >> (shift - 64);
+        }
+        return shift ? high << (64 - shift) | low >> shift : low;
 }
 
 extern uint64_t clock_microseconds(struct Clock const * clock)
@@ -0,0 +1,110 @@
+#include "../cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_FEATURES_X86 1
+#endif
+
+#if defined(CPU_FEATURES_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(CPU_FEATURES_X86)
+#include <cpuid.h>
+#endif
+
+#if defined(CPU_FEATURES_X86)
+
+static void cpu_features_cpuid(unsigned int leaf, unsigned int subleaf,
+                               unsigned int registers[4])
+{
+#if defined(_MSC_VER)
+        int values[4];
+        __cpuidex(values, leaf, subleaf);
+        for (int i = 0; i < 4; i++) {
+                registers[i] = static_cast<unsigned int>(values[i]);
+        }
+#else
+        __cpuid_count(leaf, subleaf,
+                      registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+static unsigned int cpu_features_max_leaf()
+{
+        unsigned int registers[4];
+        cpu_features_cpuid(0, 0, registers);
+        return registers[0];
+}
+
+/// whether the operating system saves the ymm registers
+static bool cpu_features_os_saves_ymm()
+{
+        unsigned int registers[4];
+        cpu_features_cpuid(1, 0, registers);
+        bool const has_osxsave = registers[2] & (1u << 27);
+        if (!has_osxsave) {
+                return false;
+        }
+
+#if defined(_MSC_VER)
+        unsigned long long const xcr0 = _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        unsigned long long const xcr0 =
+                (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+        return (xcr0 & 0x6) == 0x6;
+}
+
+extern bool cpu_has_sse2()
+{
+        unsigned int registers[4];
+        cpu_features_cpuid(1, 0, registers);
+        return registers[3] & (1u << 26);
+}
+
+extern bool cpu_has_avx2()
+{
+        if (cpu_features_max_leaf() < 7 || !cpu_features_os_saves_ymm()) {
+                return false;
+        }
+
+        unsigned int registers[4];
+        cpu_features_cpuid(1, 0, registers);
+        bool const has_avx = registers[2] & (1u << 28);
+
+        cpu_features_cpuid(7, 0, registers);
+        bool const has_avx2 = registers[1] & (1u << 5);
+
+        return has_avx && has_avx2;
+}
+
+extern bool cpu_has_invariant_tsc()
+{
+        unsigned int registers[4];
+        cpu_features_cpuid(0x80000000, 0, registers);
+        if (registers[0] < 0x80000007) {
+                return false;
+        }
+
+        cpu_features_cpuid(0x80000007, 0, registers);
+        return registers[3] & (1u << 8);
+}
+
+#else
+
+extern bool cpu_has_sse2()
+{
+        return false;
+}
+
+extern bool cpu_has_avx2()
+{
+        return false;
+}
+
+extern bool cpu_has_invariant_tsc()
+{
+        return false;
+}
+
+#endif
@@ -0,0 +1,394 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <GL/glew.h>
+
+#include "../dynamic_resolution.h"
+
+enum {
+        // frames after a change whose gpu time was measured at the
+        // previous resolution, up to the deepest pipeline
+        DYNAMIC_RESOLUTION_STALE_FRAMES = 8,
+        // frames to measure at a resolution before changing it again
+        DYNAMIC_RESOLUTION_SETTLE_FRAMES = 24,
+};
+
+// the scale aims for this fraction of the budget
+static double const DYNAMIC_RESOLUTION_TARGET = 0.8;
+// and only rises once gpu time is below this fraction
+static double const DYNAMIC_RESOLUTION_RISE_THRESHOLD = 0.65;
+
+struct DynamicResolution {
+        double budget_nanos;
+        double min_scale;
+        double scale;
+        double smoothed_gpu_nanos; // 0 until measured
+        int settle_count; // frames until the scale may change again
+
+        // target, as large as the window
+        uint32_t width;
+        uint32_t height;
+        uint32_t render_width;
+        uint32_t render_height;
+        GLuint framebuffer;
+        GLuint color_texture;
+        GLuint depth_renderbuffer;
+
+        // upscaling pass
+        GLuint program;
+        GLuint vertex_array;
+        GLint uv_scale_location;
+        GLint uv_max_location;
+
+        // statistics
+        uint64_t frame_count;
+        double scale_sum;
+        double lowest_scale;
+        uint64_t change_count;
+        uint64_t measured_frame_count;
+        uint64_t over_budget_frame_count;
+};
+
+static char const* const dynamic_resolution_vertex_shader =
+        "#version 150\n"
+        "uniform vec2 uv_scale;\n"
+        "out vec2 uv;\n"
+        "void main() {\n"
+        "        // a triangle covering the viewport\n"
+        "        vec2 position = vec2(gl_VertexID == 1 ? 3.0 : -1.0,\n"
+        "                             gl_VertexID == 2 ? 3.0 : -1.0);\n"
+        "        uv = (0.5 * position + 0.5) * uv_scale;\n"
+        "        gl_Position = vec4(position, 0.0, 1.0);\n"
+        "}\n";
+
+static char const* const dynamic_resolution_fragment_shader =
+        "#version 150\n"
+        "uniform sampler2D color;\n"
+        "uniform vec2 uv_max;\n"
+        "in vec2 uv;\n"
+        "out vec4 fragment;\n"
+        "void main() {\n"
+        "        // never filters in texels outside of the frame\n"
+        "        fragment = texture(color, min(uv, uv_max));\n"
+        "}\n";
+
+static GLuint dynamic_resolution_compile(GLenum type, char const* source)
+{
+        GLuint const shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+
+        GLint status;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (GL_TRUE != status) {
+                char log[1024];
+                glGetShaderInfoLog(shader, sizeof log, NULL, log);
+                printf("dynamic resolution: could not compile shader: %s\n",
+                       log);
+        }
+        return shader;
+}
+
+static GLuint dynamic_resolution_link()
+{
+        GLuint const vertex_shader =
+                dynamic_resolution_compile(GL_VERTEX_SHADER,
+                                           dynamic_resolution_vertex_shader);
+        GLuint const fragment_shader =
+                dynamic_resolution_compile(GL_FRAGMENT_SHADER,
+                                           dynamic_resolution_fragment_shader);
+
+        GLuint const program = glCreateProgram();
+        glAttachShader(program, vertex_shader);
+        glAttachShader(program, fragment_shader);
+        glBindFragDataLocation(program, 0, "fragment");
+        glLinkProgram(program);
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (GL_TRUE != status) {
+                char log[1024];
+                glGetProgramInfoLog(program, sizeof log, NULL, log);
+                printf("dynamic resolution: could not link program: %s\n", log);
+                glDeleteProgram(program);
+                return 0;
+        }
+        return program;
+}
+
+static double dynamic_resolution_getenv(char const* name,
+                                        double default_value)
+{
+        char const* value = getenv(name);
+        return value && value[0] ? atof(value) : default_value;
+}
+
+/// (re)allocates the target for a window of the given size
+static void dynamic_resolution_resize(struct DynamicResolution* resolution,
+                                      uint32_t width,
+                                      uint32_t height)
+{
+        glBindTexture(GL_TEXTURE_2D, resolution->color_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, resolution->depth_renderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width,
+                              height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, resolution->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, resolution->color_texture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                                  GL_RENDERBUFFER,
+                                  resolution->depth_renderbuffer);
+        if (GL_FRAMEBUFFER_COMPLETE !=
+            glCheckFramebufferStatus(GL_FRAMEBUFFER)) {
+                printf("dynamic resolution: could not create %ux%u target\n",
+                       width, height);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        resolution->width = width;
+        resolution->height = height;
+}
+
+extern struct DynamicResolution* dynamic_resolution_create(
+        uint64_t frame_period_micros)
+{
+        char const* enabled = getenv("MICROS_DYNAMIC_RESOLUTION");
+        if (!enabled || atoi(enabled) <= 0) {
+                return NULL;
+        }
+
+        // the resolution would never adapt without gpu times
+        if (!GLEW_VERSION_3_3 && !GLEW_ARB_timer_query) {
+                printf("dynamic resolution: off, as timer queries are not "
+                       "supported\n");
+                return NULL;
+        }
+
+        GLuint const program = dynamic_resolution_link();
+        if (!program) {
+                return NULL;
+        }
+
+        double const default_budget_ms = 0.9 * frame_period_micros / 1e3;
+        double const budget_ms =
+                dynamic_resolution_getenv("MICROS_GPU_BUDGET_MS",
+                                          default_budget_ms);
+        double min_scale =
+                dynamic_resolution_getenv("MICROS_DYNAMIC_RESOLUTION_MIN", 0.5);
+        min_scale = min_scale < 0.125 ? 0.125 : min_scale > 1.0 ? 1.0 :
+                    min_scale;
+
+        struct DynamicResolution* resolution = new DynamicResolution;
+        resolution->budget_nanos = 1e6 * budget_ms;
+        resolution->min_scale = min_scale;
+        resolution->scale = 1.0;
+        resolution->smoothed_gpu_nanos = 0.0;
+        resolution->settle_count = 0;
+
+        resolution->width = 0;
+        resolution->height = 0;
+        resolution->render_width = 0;
+        resolution->render_height = 0;
+        glGenFramebuffers(1, &resolution->framebuffer);
+        glGenTextures(1, &resolution->color_texture);
+        glBindTexture(GL_TEXTURE_2D, resolution->color_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenRenderbuffers(1, &resolution->depth_renderbuffer);
+
+        resolution->program = program;
+        glGenVertexArrays(1, &resolution->vertex_array);
+        resolution->uv_scale_location =
+                glGetUniformLocation(program, "uv_scale");
+        resolution->uv_max_location = glGetUniformLocation(program, "uv_max");
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "color"), 0);
+        glUseProgram(0);
+
+        resolution->frame_count = 0;
+        resolution->scale_sum = 0.0;
+        resolution->lowest_scale = 1.0;
+        resolution->change_count = 0;
+        resolution->measured_frame_count = 0;
+        resolution->over_budget_frame_count = 0;
+
+        printf("dynamic resolution: gpu budget of %.2fms, scale down to %.3f\n",
+               budget_ms, min_scale);
+        return resolution;
+}
+
+extern void dynamic_resolution_destroy(struct DynamicResolution* resolution)
+{
+        if (!resolution) {
+                return;
+        }
+
+        if (resolution->frame_count) {
+                printf("dynamic resolution: mean scale %.3f (lowest %.3f), "
+                       "%llu changes",
+                       resolution->scale_sum / resolution->frame_count,
+                       resolution->lowest_scale,
+                       static_cast<unsigned long long>(resolution->change_count));
+                if (resolution->measured_frame_count) {
+                        printf(", %.1f%% of frames over budget",
+                               100.0 * resolution->over_budget_frame_count /
+                               resolution->measured_frame_count);
+                }
+                printf("\n");
+        }
+
+        glDeleteVertexArrays(1, &resolution->vertex_array);
+        glDeleteProgram(resolution->program);
+        glDeleteFramebuffers(1, &resolution->framebuffer);
+        glDeleteTextures(1, &resolution->color_texture);
+        glDeleteRenderbuffers(1, &resolution->depth_renderbuffer);
+        delete resolution;
+}
+
+extern void dynamic_resolution_measure(struct DynamicResolution* resolution,
+                                       uint64_t gpu_nanos)
+{
+        // unknown until the pipeline is full
+        if (!resolution || 0 == gpu_nanos) {
+                return;
+        }
+
+        resolution->measured_frame_count++;
+        if (gpu_nanos > resolution->budget_nanos) {
+                resolution->over_budget_frame_count++;
+        }
+
+        if (resolution->settle_count > 0) {
+                resolution->settle_count--;
+                if (resolution->settle_count >=
+                    DYNAMIC_RESOLUTION_SETTLE_FRAMES -
+                    DYNAMIC_RESOLUTION_STALE_FRAMES) {
+                        return;
+                }
+        }
+
+        double const nanos = static_cast<double>(gpu_nanos);
+        double smoothed = resolution->smoothed_gpu_nanos;
+        smoothed = smoothed > 0.0 ? smoothed + (nanos - smoothed) / 8.0 : nanos;
+        resolution->smoothed_gpu_nanos = smoothed;
+        if (resolution->settle_count > 0) {
+                return;
+        }
+
+        double const budget = resolution->budget_nanos;
+        bool const is_over = smoothed > budget;
+        bool const can_rise = resolution->scale < 1.0 &&
+                              smoothed < DYNAMIC_RESOLUTION_RISE_THRESHOLD * budget;
+        if (!is_over && !can_rise) {
+                return;
+        }
+
+        // gpu time is assumed to follow the pixel count, the square of
+        // the scale. It drops fast but rises by small steps
+        double factor = sqrt(DYNAMIC_RESOLUTION_TARGET * budget / smoothed);
+        factor = factor < 0.7 ? 0.7 : factor > 1.1 ? 1.1 : factor;
+        double scale = resolution->scale * factor;
+        scale = scale < resolution->min_scale ? resolution->min_scale :
+                scale > 1.0 ? 1.0 : scale;
+        if (scale == resolution->scale) {
+                return;
+        }
+
+        // predicts the gpu time at the new scale until it is measured
+        double const ratio = scale / resolution->scale;
+        resolution->smoothed_gpu_nanos = smoothed * ratio * ratio;
+        resolution->scale = scale;
+        resolution->settle_count = DYNAMIC_RESOLUTION_SETTLE_FRAMES;
+        resolution->change_count++;
+}
+
+extern void dynamic_resolution_begin_frame(struct DynamicResolution* resolution,
+                uint32_t window_width,
+                uint32_t window_height,
+                uint32_t* render_widthp,
+                uint32_t* render_heightp)
+{
+        if (!resolution) {
+                *render_widthp = window_width;
+                *render_heightp = window_height;
+                glViewport(0, 0, window_width, window_height);
+                return;
+        }
+
+        if (window_width != resolution->width ||
+            window_height != resolution->height) {
+                dynamic_resolution_resize(resolution, window_width,
+                                          window_height);
+        }
+
+        double const scale = resolution->scale;
+        uint32_t width = static_cast<uint32_t>(window_width * scale + 0.5);
+        uint32_t height = static_cast<uint32_t>(window_height * scale + 0.5);
+        width = width < 1 ? 1 : width;
+        height = height < 1 ? 1 : height;
+        resolution->render_width = width;
+        resolution->render_height = height;
+
+        resolution->frame_count++;
+        resolution->scale_sum += scale;
+        if (scale < resolution->lowest_scale) {
+                resolution->lowest_scale = scale;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, resolution->framebuffer);
+        glViewport(0, 0, width, height);
+        *render_widthp = width;
+        *render_heightp = height;
+}
+
+extern void dynamic_resolution_end_frame(struct DynamicResolution* resolution)
+{
+        if (!resolution) {
+                return;
+        }
+
+        // set rather than saved and restored: queries would stall the
+        // driver every frame, and demos set the state they rely on
+        glDisable(GL_BLEND);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_SCISSOR_TEST);
+        glDisable(GL_STENCIL_TEST);
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glActiveTexture(GL_TEXTURE0);
+        if (GLEW_VERSION_3_3) {
+                glBindSampler(0, 0);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, resolution->width, resolution->height);
+        glUseProgram(resolution->program);
+        glUniform2f(resolution->uv_scale_location,
+                    static_cast<float>(resolution->render_width) /
+                    resolution->width,
+                    static_cast<float>(resolution->render_height) /
+                    resolution->height);
+        glUniform2f(resolution->uv_max_location,
+                    (resolution->render_width - 0.5f) / resolution->width,
+                    (resolution->render_height - 0.5f) / resolution->height);
+        glBindTexture(GL_TEXTURE_2D, resolution->color_texture);
+        glBindVertexArray(resolution->vertex_array);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+}
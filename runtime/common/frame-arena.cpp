@@ -0,0 +1,154 @@
+/**
+ * \file
+ *
+ * Frame arenas, and the per thread arenas behind frame_allocator().
+ *
+ * Each thread gets its arena when it first asks for it, sized by
+ * MICROS_FRAME_ARENA_BYTES (4MiB by default). The memory is touched
+ * right away so that later allocations never page fault.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // memset
+
+#include <micros/api.h>
+
+#include "../allocator.h"
+#include "../frame_arena.h"
+#include "../tracking_allocator.h"
+
+static size_t const FRAME_ARENA_ALIGNMENT = 16;
+
+static void* frame_arena_alloc(struct Allocator* self, size_t size)
+{
+        struct FrameArena* arena = reinterpret_cast<struct FrameArena*>(self);
+
+        size_t const start = (arena->used + FRAME_ARENA_ALIGNMENT - 1) &
+                             ~(FRAME_ARENA_ALIGNMENT - 1);
+        if (start > arena->capacity || size > arena->capacity - start) {
+                if (!arena->has_overflowed) {
+                        arena->has_overflowed = true;
+                        printf("frame arena of %llu bytes exhausted\n",
+                               static_cast<unsigned long long>(arena->capacity));
+                }
+                return NULL;
+        }
+
+        arena->used = start + size;
+        return arena->memory + start;
+}
+
+static void frame_arena_free(struct Allocator* self, void* ptr)
+{
+        // released all at once, by frame_arena_reset
+        (void) self;
+        (void) ptr;
+}
+
+extern int frame_arena_init(struct FrameArena* arena,
+                            struct Allocator* parent,
+                            size_t capacity)
+{
+        char* memory = capacity ?
+                       static_cast<char*>(allocator_alloc(parent, capacity)) : NULL;
+        if (!memory && capacity) {
+                return -1;
+        }
+        memset(memory, 0, capacity);
+
+        arena->allocator.alloc = frame_arena_alloc;
+        arena->allocator.free = frame_arena_free;
+        arena->parent = parent;
+        arena->memory = memory;
+        arena->capacity = capacity;
+        arena->used = 0;
+        arena->has_overflowed = false;
+
+        return 0;
+}
+
+extern void frame_arena_deinit(struct FrameArena* arena)
+{
+        allocator_free(arena->parent, arena->memory);
+        arena->memory = NULL;
+        arena->capacity = 0;
+        arena->used = 0;
+}
+
+extern void frame_arena_reset(struct FrameArena* arena)
+{
+        arena->used = 0;
+}
+
+static void* heap_alloc(struct Allocator* self, size_t size)
+{
+        return malloc(size);
+}
+
+static void heap_free(struct Allocator* self, void* ptr)
+{
+        free(ptr);
+}
+
+static struct Allocator heap_allocator = { heap_alloc, heap_free };
+
+/// owns the arena of a thread, releasing it when the thread ends
+struct ThreadFrameArena {
+        struct FrameArena arena;
+        struct TrackingAllocator tracking;
+        struct Allocator* allocator;
+        bool is_initialized;
+
+        ~ThreadFrameArena()
+        {
+                if (is_initialized) {
+                        frame_arena_deinit(&arena);
+                }
+        }
+};
+
+static thread_local struct ThreadFrameArena thread_frame_arena;
+
+static size_t frame_arena_capacity()
+{
+        char const* bytes = getenv("MICROS_FRAME_ARENA_BYTES");
+        long long const capacity = bytes ? atoll(bytes) : 0;
+        return capacity > 0 ? static_cast<size_t>(capacity) : 4 << 20;
+}
+
+extern struct Allocator* frame_allocator()
+{
+        struct ThreadFrameArena* thread_arena = &thread_frame_arena;
+        if (!thread_arena->is_initialized) {
+                if (frame_arena_init(&thread_arena->arena, &heap_allocator,
+                                     frame_arena_capacity())) {
+                        // an empty arena, whose allocations all fail
+                        printf("could not allocate frame arena\n");
+                        frame_arena_init(&thread_arena->arena, &heap_allocator, 0);
+                }
+                thread_arena->allocator = tracking_allocator_wrap(
+                                                  &thread_arena->tracking,
+                                                  &thread_arena->arena.allocator,
+                                                  "frame", true);
+                thread_arena->is_initialized = true;
+        }
+
+        return thread_arena->allocator;
+}
+
+extern void frame_arena_prepare_thread()
+{
+        frame_allocator();
+}
+
+extern void frame_arena_reset_thread()
+{
+        struct ThreadFrameArena* thread_arena = &thread_frame_arena;
+        if (thread_arena->is_initialized) {
+                frame_arena_reset(&thread_arena->arena);
+                if (thread_arena->allocator == &thread_arena->tracking.allocator) {
+                        tracking_allocator_release_all(&thread_arena->tracking);
+                }
+        }
+}
@@ -0,0 +1,614 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <GL/glew.h>
+
+#include "../clock.h"
+#include "../frame_capture.h"
+#include "../pixel_convert.h"
+
+enum {
+        FRAME_CAPTURE_SLOT_COUNT = 4,
+        FRAME_CAPTURE_BAND_ROWS = 16, // converted by a worker at a time
+        FRAME_CAPTURE_CONVERTER_MAX = 32,
+};
+
+enum FrameCaptureSlotState {
+        FRAME_CAPTURE_FREE,
+        FRAME_CAPTURE_READING, // transfer from the gpu in progress
+        FRAME_CAPTURE_MAPPED, // handed to the converters or the writer
+        FRAME_CAPTURE_CONVERTED, // handed to the writer
+        FRAME_CAPTURE_WRITTEN, // to unmap
+        FRAME_CAPTURE_STATE_COUNT,
+};
+
+struct FrameCaptureSlot {
+        GLuint buffer;
+        GLsync fence;
+        void const* pixels;
+        uint8_t* yuv; // planes of the converted frame
+        uint64_t sequence; // order of the frame in the capture
+        std::atomic<uint32_t> next_band; // to be claimed by a converter
+        std::atomic<uint32_t> remaining_bands; // to be converted
+        std::atomic<int> state;
+};
+
+struct FrameCapture {
+        FILE* file;
+        struct Clock* clock;
+        uint32_t width;
+        uint32_t height;
+        bool is_offline;
+        bool is_y4m;
+        uint32_t band_count;
+        size_t yuv_size;
+        uint64_t read_count; // frames read back
+        uint64_t map_count; // frames handed to the writer
+        uint64_t dropped_frame_count;
+        bool has_warned_of_size;
+        // frames of another size are scaled into it, at the capture size
+        GLuint scale_framebuffer;
+        GLuint scale_renderbuffer;
+
+        // statistics of each stage
+        uint64_t wait_micros; // render thread waiting for a free slot
+        uint64_t depth_sums[FRAME_CAPTURE_STATE_COUNT];
+        uint64_t depth_sample_count;
+        std::atomic<uint64_t> convert_micros; // summed over converters
+        uint64_t write_micros;
+        uint64_t written_bytes;
+        uint64_t written_frame_count; // by the writer
+
+        std::atomic<bool> has_failed; // to write, which stops the capture
+        std::atomic<bool> must_stop;
+        std::thread writer;
+        int converter_count;
+        std::thread converters[FRAME_CAPTURE_CONVERTER_MAX];
+        struct FrameCaptureSlot slots[FRAME_CAPTURE_SLOT_COUNT];
+};
+
+static void frame_capture_convert_band(struct FrameCapture const* capture,
+                                       struct FrameCaptureSlot const* slot,
+                                       uint32_t band)
+{
+        uint32_t const width = capture->width;
+        uint32_t const height = capture->height;
+        uint32_t const chroma_width = (width + 1) / 2;
+        uint32_t const chroma_height = (height + 1) / 2;
+        uint8_t const* pixels = static_cast<uint8_t const*>(slot->pixels);
+        uint8_t* luma = slot->yuv;
+        uint8_t* u = luma + width * height;
+        uint8_t* v = u + chroma_width * chroma_height;
+
+        uint32_t const first_y = band * FRAME_CAPTURE_BAND_ROWS;
+        uint32_t const last_y = first_y + FRAME_CAPTURE_BAND_ROWS < height ?
+                                first_y + FRAME_CAPTURE_BAND_ROWS : height;
+        size_t const row_size = 4 * width;
+        for (uint32_t y = first_y; y < last_y; y += 2) {
+                uint32_t const next_y = y + 1 < height ? y + 1 : y;
+                // rows come bottom first from OpenGL
+                uint8_t const* rgba_row0 = &pixels[row_size * (height - 1 - y)];
+                uint8_t const* rgba_row1 =
+                        &pixels[row_size * (height - 1 - next_y)];
+                pixel_convert_rgba_to_yuv420(&luma[y * width],
+                                             &luma[next_y * width],
+                                             &u[y / 2 * chroma_width],
+                                             &v[y / 2 * chroma_width],
+                                             rgba_row0, rgba_row1,
+                                             static_cast<int>(width));
+        }
+}
+
+/// claims a band of the oldest frame waiting for conversion
+static struct FrameCaptureSlot* frame_capture_claim_band(
+        struct FrameCapture* capture,
+        uint32_t* band)
+{
+        for (;;) {
+                struct FrameCaptureSlot* slot = NULL;
+                for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                        struct FrameCaptureSlot* candidate = &capture->slots[i];
+                        if (FRAME_CAPTURE_MAPPED == candidate->state.load() &&
+                            candidate->next_band.load() < capture->band_count &&
+                            (!slot || candidate->sequence < slot->sequence)) {
+                                slot = candidate;
+                        }
+                }
+                if (!slot) {
+                        return NULL;
+                }
+
+                *band = slot->next_band.fetch_add(1);
+                if (*band < capture->band_count) {
+                        return slot;
+                }
+        }
+}
+
+static void frame_capture_convert_loop(struct FrameCapture* capture)
+{
+        auto const idle_duration = std::chrono::milliseconds(1);
+
+        for (;;) {
+                uint32_t band;
+                struct FrameCaptureSlot* slot =
+                        frame_capture_claim_band(capture, &band);
+                if (!slot) {
+                        if (capture->must_stop.load()) {
+                                return;
+                        }
+                        std::this_thread::sleep_for(idle_duration);
+                        continue;
+                }
+
+                uint64_t const start_micros = clock_microseconds(capture->clock);
+                frame_capture_convert_band(capture, slot, band);
+                capture->convert_micros.fetch_add(
+                        clock_microseconds(capture->clock) - start_micros);
+
+                if (1 == slot->remaining_bands.fetch_sub(1)) {
+                        slot->state.store(FRAME_CAPTURE_CONVERTED);
+                }
+        }
+}
+
+/// @return whether the whole frame reached the file
+static bool frame_capture_write_frame(struct FrameCapture* capture,
+                                      struct FrameCaptureSlot const* slot)
+{
+        if (capture->is_y4m) {
+                if (EOF == fputs("FRAME\n", capture->file) ||
+                    1 != fwrite(slot->yuv, capture->yuv_size, 1,
+                                capture->file)) {
+                        return false;
+                }
+                capture->written_bytes += capture->yuv_size;
+                return true;
+        }
+
+        // rows come bottom first from OpenGL
+        size_t const row_size = 4 * capture->width;
+        char const* pixels = static_cast<char const*>(slot->pixels);
+        for (uint32_t y = capture->height; y-- > 0;) {
+                if (1 != fwrite(pixels + y * row_size, row_size, 1,
+                                capture->file)) {
+                        return false;
+                }
+                capture->written_bytes += row_size;
+        }
+        return true;
+}
+
+static void frame_capture_write_loop(struct FrameCapture* capture)
+{
+        auto const idle_duration = std::chrono::milliseconds(1);
+        int const ready_state = capture->is_y4m ?
+                                FRAME_CAPTURE_CONVERTED : FRAME_CAPTURE_MAPPED;
+        uint64_t sequence = 0;
+
+        for (;;) {
+                struct FrameCaptureSlot* slot = NULL;
+                for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                        struct FrameCaptureSlot* candidate = &capture->slots[i];
+                        if (ready_state == candidate->state.load() &&
+                            sequence == candidate->sequence) {
+                                slot = candidate;
+                                break;
+                        }
+                }
+
+                if (!slot) {
+                        if (capture->must_stop.load()) {
+                                return;
+                        }
+                        std::this_thread::sleep_for(idle_duration);
+                        continue;
+                }
+
+                // after a failure, frames are only released
+                if (!capture->has_failed.load()) {
+                        uint64_t const start_micros =
+                                clock_microseconds(capture->clock);
+                        if (frame_capture_write_frame(capture, slot)) {
+                                capture->written_frame_count++;
+                        } else {
+                                printf("capture: could not write frame %llu, "
+                                       "stopping the capture\n",
+                                       static_cast<unsigned long long>(
+                                               sequence));
+                                capture->has_failed.store(true);
+                        }
+                        capture->write_micros +=
+                                clock_microseconds(capture->clock) -
+                                start_micros;
+                }
+
+                slot->state.store(FRAME_CAPTURE_WRITTEN);
+                sequence++;
+        }
+}
+
+/// unmaps the frames the writer is done with
+static void frame_capture_reclaim(struct FrameCapture* capture)
+{
+        for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                struct FrameCaptureSlot* slot = &capture->slots[i];
+                if (FRAME_CAPTURE_WRITTEN != slot->state.load()) {
+                        continue;
+                }
+
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                slot->pixels = NULL;
+                slot->state.store(FRAME_CAPTURE_FREE);
+        }
+}
+
+/**
+ * hands the oldest frame read back to the writer, once its transfer
+ * has completed.
+ *
+ * @param timeout_nanos how long to wait for the transfer
+ */
+static void frame_capture_map(struct FrameCapture* capture,
+                              GLuint64 timeout_nanos)
+{
+        if (capture->map_count == capture->read_count) {
+                return;
+        }
+
+        struct FrameCaptureSlot* slot = NULL;
+        for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                struct FrameCaptureSlot* candidate = &capture->slots[i];
+                if (FRAME_CAPTURE_READING == candidate->state.load() &&
+                    capture->map_count == candidate->sequence) {
+                        slot = candidate;
+                        break;
+                }
+        }
+
+        GLbitfield const flags = timeout_nanos ? GL_SYNC_FLUSH_COMMANDS_BIT : 0;
+        GLenum const result = glClientWaitSync(slot->fence, flags,
+                                               timeout_nanos);
+        if (GL_ALREADY_SIGNALED != result && GL_CONDITION_SATISFIED != result) {
+                return;
+        }
+        glDeleteSync(slot->fence);
+        slot->fence = NULL;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+        slot->pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                        4 * capture->width * capture->height,
+                                        GL_MAP_READ_BIT);
+        // converters late to claim a band of the previous frame may
+        // only see bands of this one once everything else is set
+        slot->remaining_bands.store(capture->band_count);
+        slot->next_band.store(0);
+        slot->state.store(FRAME_CAPTURE_MAPPED);
+        capture->map_count++;
+}
+
+static bool frame_capture_is_idle(struct FrameCapture* capture)
+{
+        for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                if (FRAME_CAPTURE_FREE != capture->slots[i].state.load()) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+static struct FrameCaptureSlot* frame_capture_free_slot(
+        struct FrameCapture* capture)
+{
+        for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                struct FrameCaptureSlot* slot = &capture->slots[i];
+                if (FRAME_CAPTURE_FREE == slot->state.load()) {
+                        return slot;
+                }
+        }
+        return NULL;
+}
+
+static bool frame_capture_is_y4m_path(char const* path)
+{
+        size_t const length = strlen(path);
+        return length >= 4 && 0 == strcmp(path + length - 4, ".y4m");
+}
+
+static int frame_capture_converter_count()
+{
+        char const* threads = getenv("MICROS_CAPTURE_THREADS");
+        int count = threads && threads[0] ? atoi(threads) :
+                    static_cast<int>(std::thread::hardware_concurrency()) - 2;
+        // leaves a core to the render thread and one to the writer
+        count = count < 1 ? 1 : count;
+        return count > FRAME_CAPTURE_CONVERTER_MAX ?
+               FRAME_CAPTURE_CONVERTER_MAX : count;
+}
+
+extern struct FrameCapture* frame_capture_create(char const* path,
+                struct Clock* clock,
+                uint32_t width,
+                uint32_t height,
+                uint32_t frames_per_second,
+                bool is_offline)
+{
+        if (!path || !path[0]) {
+                return NULL;
+        }
+
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+                printf("capture: could not open %s\n", path);
+                return NULL;
+        }
+
+        struct FrameCapture* capture = new FrameCapture;
+        capture->file = file;
+        capture->clock = clock;
+        capture->width = width;
+        capture->height = height;
+        capture->is_offline = is_offline;
+        capture->is_y4m = frame_capture_is_y4m_path(path);
+        capture->band_count =
+                (height + FRAME_CAPTURE_BAND_ROWS - 1) / FRAME_CAPTURE_BAND_ROWS;
+        capture->yuv_size = width * height +
+                            2 * ((width + 1) / 2) * ((height + 1) / 2);
+        capture->read_count = 0;
+        capture->map_count = 0;
+        capture->dropped_frame_count = 0;
+        capture->has_warned_of_size = false;
+        capture->scale_framebuffer = 0;
+        capture->scale_renderbuffer = 0;
+        capture->wait_micros = 0;
+        for (int i = 0; i < FRAME_CAPTURE_STATE_COUNT; i++) {
+                capture->depth_sums[i] = 0;
+        }
+        capture->depth_sample_count = 0;
+        capture->convert_micros.store(0);
+        capture->write_micros = 0;
+        capture->written_bytes = 0;
+        capture->written_frame_count = 0;
+        capture->has_failed.store(false);
+        capture->must_stop.store(false);
+        capture->converter_count =
+                capture->is_y4m ? frame_capture_converter_count() : 0;
+
+        if (capture->is_y4m) {
+                // C420jpeg: chroma sited at the center of each 2x2 block
+                if (fprintf(file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 "
+                            "C420jpeg\n", width, height,
+                            frames_per_second) < 0) {
+                        printf("capture: could not write to %s\n", path);
+                        fclose(file);
+                        delete capture;
+                        return NULL;
+                }
+        }
+
+        GLint previous_buffer;
+        glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previous_buffer);
+        for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                struct FrameCaptureSlot* slot = &capture->slots[i];
+                glGenBuffers(1, &slot->buffer);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+                glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, NULL,
+                             GL_STREAM_READ);
+                slot->fence = NULL;
+                slot->pixels = NULL;
+                slot->yuv = capture->is_y4m ? new uint8_t[capture->yuv_size] :
+                            NULL;
+                slot->sequence = 0;
+                slot->next_band.store(capture->band_count);
+                slot->remaining_bands.store(0);
+                slot->state.store(FRAME_CAPTURE_FREE);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, previous_buffer);
+
+        capture->writer = std::thread(frame_capture_write_loop, capture);
+        for (int i = 0; i < capture->converter_count; i++) {
+                capture->converters[i] =
+                        std::thread(frame_capture_convert_loop, capture);
+        }
+
+        if (capture->is_y4m) {
+                printf("capture: writing %ux%u yuv420 frames to %s, "
+                       "converted by %d threads (%s)\n", width, height, path,
+                       capture->converter_count,
+                       pixel_convert_implementation());
+        } else {
+                printf("capture: writing %ux%u rgba frames to %s\n", width,
+                       height, path);
+        }
+        return capture;
+}
+
+static void frame_capture_print_summary(struct FrameCapture const* capture)
+{
+        printf("capture: %llu frames written, %llu dropped%s\n",
+               static_cast<unsigned long long>(capture->written_frame_count),
+               static_cast<unsigned long long>(capture->dropped_frame_count),
+               capture->has_failed.load() ? ", stopped by a failed write" :
+               "");
+        if (!capture->written_frame_count) {
+                return;
+        }
+
+        double const frame_count =
+                static_cast<double>(capture->written_frame_count);
+        if (capture->depth_sample_count) {
+                double const sample_count = capture->depth_sample_count;
+                printf("capture: waited %.1fms for free slots, "
+                       "mean queue depths: reading %.2f, mapped %.2f, "
+                       "converted %.2f, written %.2f\n",
+                       capture->wait_micros / 1e3,
+                       capture->depth_sums[FRAME_CAPTURE_READING] / sample_count,
+                       capture->depth_sums[FRAME_CAPTURE_MAPPED] / sample_count,
+                       capture->depth_sums[FRAME_CAPTURE_CONVERTED] / sample_count,
+                       capture->depth_sums[FRAME_CAPTURE_WRITTEN] / sample_count);
+        }
+        if (capture->is_y4m) {
+                double const convert_micros = capture->convert_micros.load();
+                printf("capture: conversion took %.2fms of cpu per frame, "
+                       "%.1f frames per second per thread\n",
+                       convert_micros / 1e3 / frame_count,
+                       convert_micros > 0.0 ? frame_count * 1e6 / convert_micros :
+                       0.0);
+        }
+        double const write_seconds = capture->write_micros / 1e6;
+        printf("capture: writing took %.2fms per frame (%.1fMiB/s)\n",
+               capture->write_micros / 1e3 / frame_count,
+               write_seconds > 0.0 ?
+               capture->written_bytes / write_seconds / (1024.0 * 1024.0) :
+               0.0);
+}
+
+extern void frame_capture_destroy(struct FrameCapture* capture)
+{
+        if (!capture) {
+                return;
+        }
+
+        // lets the writer finish the frames read back so far
+        auto const idle_duration = std::chrono::milliseconds(1);
+        while (!frame_capture_is_idle(capture)) {
+                frame_capture_map(capture, 1000000);
+                std::this_thread::sleep_for(idle_duration);
+                frame_capture_reclaim(capture);
+        }
+
+        capture->must_stop.store(true);
+        capture->writer.join();
+        for (int i = 0; i < capture->converter_count; i++) {
+                capture->converters[i].join();
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                glDeleteBuffers(1, &capture->slots[i].buffer);
+                delete[] capture->slots[i].yuv;
+        }
+        glDeleteFramebuffers(1, &capture->scale_framebuffer);
+        glDeleteRenderbuffers(1, &capture->scale_renderbuffer);
+        // buffered frames only reach the file now
+        if (0 != fclose(capture->file)) {
+                capture->has_failed.store(true);
+        }
+
+        frame_capture_print_summary(capture);
+        delete capture;
+}
+
+/**
+ * scales a frame of another size than the capture, after a window
+ * resize, into a framebuffer of the capture size, as the file format
+ * has a single frame size.
+ *
+ * @return the framebuffer to read the frame from
+ */
+static GLuint frame_capture_scale(struct FrameCapture* capture,
+                                  GLuint framebuffer,
+                                  uint32_t width,
+                                  uint32_t height)
+{
+        GLint previous_read_framebuffer;
+        GLint previous_draw_framebuffer;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_read_framebuffer);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous_draw_framebuffer);
+
+        if (!capture->scale_framebuffer) {
+                glGenRenderbuffers(1, &capture->scale_renderbuffer);
+                glBindRenderbuffer(GL_RENDERBUFFER,
+                                   capture->scale_renderbuffer);
+                glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, capture->width,
+                                      capture->height);
+                glBindRenderbuffer(GL_RENDERBUFFER, 0);
+                glGenFramebuffers(1, &capture->scale_framebuffer);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER,
+                                  capture->scale_framebuffer);
+                glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER,
+                                          GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                                          capture->scale_renderbuffer);
+        }
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, capture->scale_framebuffer);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, capture->width,
+                          capture->height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, previous_read_framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous_draw_framebuffer);
+        return capture->scale_framebuffer;
+}
+
+extern void frame_capture_read(struct FrameCapture* capture,
+                               unsigned int framebuffer,
+                               uint32_t width,
+                               uint32_t height)
+{
+        if (!capture || capture->has_failed.load()) {
+                return;
+        }
+
+        if (width != capture->width || height != capture->height) {
+                if (!capture->has_warned_of_size) {
+                        capture->has_warned_of_size = true;
+                        printf("capture: scaling frames of %ux%u to %ux%u\n",
+                               width, height, capture->width,
+                               capture->height);
+                }
+                framebuffer = frame_capture_scale(capture, framebuffer, width,
+                                                  height);
+        }
+
+        GLint previous_buffer;
+        glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previous_buffer);
+
+        frame_capture_reclaim(capture);
+        frame_capture_map(capture, 0);
+
+        for (int i = 0; i < FRAME_CAPTURE_SLOT_COUNT; i++) {
+                capture->depth_sums[capture->slots[i].state.load()]++;
+        }
+        capture->depth_sample_count++;
+
+        struct FrameCaptureSlot* slot = frame_capture_free_slot(capture);
+        if (!slot && capture->is_offline) {
+                // offline, frames are waited for rather than dropped
+                uint64_t const start_micros = clock_microseconds(capture->clock);
+                auto const idle_duration = std::chrono::milliseconds(1);
+                while (!slot) {
+                        frame_capture_map(capture, 1000000);
+                        std::this_thread::sleep_for(idle_duration);
+                        frame_capture_reclaim(capture);
+                        slot = frame_capture_free_slot(capture);
+                }
+                capture->wait_micros +=
+                        clock_microseconds(capture->clock) - start_micros;
+        }
+
+        if (slot) {
+                GLint previous_framebuffer;
+                glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING,
+                              &previous_framebuffer);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+                glPixelStorei(GL_PACK_ALIGNMENT, 4);
+                glReadPixels(0, 0, capture->width, capture->height, GL_RGBA,
+                             GL_UNSIGNED_BYTE, 0);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, previous_framebuffer);
+
+                slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                // starts the transfer even when no swap follows
+                glFlush();
+                slot->sequence = capture->read_count++;
+                slot->state.store(FRAME_CAPTURE_READING);
+        } else {
+                capture->dropped_frame_count++;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, previous_buffer);
+}
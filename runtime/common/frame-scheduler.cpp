@@ -0,0 +1,168 @@
+#include <math.h> // sqrt
+#include <cstdio>
+#include <cstdlib>
+
+#include "../clock.h"
+#include "../frame_scheduler.h"
+
+/// weight of each new sample in the estimates
+static double const FRAME_SCHEDULER_SMOOTHING = 1.0 / 16;
+
+static int frame_scheduler_swap_interval()
+{
+        char const* interval = getenv("MICROS_SWAP_INTERVAL");
+        int const swap_interval = interval && interval[0] ? atoi(interval) : 1;
+        return swap_interval < 0 ? 0 : swap_interval;
+}
+
+extern void frame_scheduler_init(struct FrameScheduler* scheduler,
+                                 struct Clock* clock,
+                                 int refresh_hz)
+{
+        scheduler->clock = clock;
+        scheduler->swap_interval = frame_scheduler_swap_interval();
+        scheduler->period_micros = 1e6 / (refresh_hz > 0 ? refresh_hz : 60);
+        scheduler->render_micros = 0.0;
+        scheduler->frame_start_micros = 0;
+        scheduler->present_micros = 0;
+        scheduler->last_swap_micros = 0;
+        scheduler->skipped_vblanks = 0;
+
+        scheduler->frame_count = 0;
+        scheduler->missed_vblank_count = 0;
+        scheduler->skipped_vblank_count = 0;
+        scheduler->max_interval_micros = 0;
+        scheduler->interval_sum = 0.0;
+        scheduler->interval_square_sum = 0.0;
+        scheduler->prediction_error_sum = 0.0;
+
+        printf("frame scheduler: %.2f Hz display, swap interval %d\n",
+               1e6 / scheduler->period_micros, scheduler->swap_interval);
+}
+
+/// keeps frame times in strict order, whatever the estimates did
+static uint64_t frame_scheduler_predict(struct FrameScheduler* scheduler,
+                                        uint64_t present_micros)
+{
+        if (present_micros <= scheduler->present_micros) {
+                present_micros = scheduler->present_micros + 1;
+        }
+        scheduler->present_micros = present_micros;
+        return present_micros;
+}
+
+extern uint64_t frame_scheduler_begin_frame(struct FrameScheduler* scheduler)
+{
+        uint64_t const now = clock_microseconds(scheduler->clock);
+        uint64_t const ready_micros =
+                now + static_cast<uint64_t>(scheduler->render_micros);
+
+        scheduler->frame_start_micros = now;
+        scheduler->skipped_vblanks = 0;
+        if (0 == scheduler->swap_interval || 0 == scheduler->last_swap_micros) {
+                return frame_scheduler_predict(scheduler, ready_micros);
+        }
+
+        // the last swap returned on a vblank, this frame shows on the
+        // first one it can be ready for
+        double const frame_period =
+                scheduler->swap_interval * scheduler->period_micros;
+        double present = scheduler->last_swap_micros + frame_period;
+        if (present < ready_micros) {
+                double const late_periods =
+                        ceil((ready_micros - present) / frame_period);
+                present += late_periods * frame_period;
+                scheduler->skipped_vblanks = scheduler->swap_interval *
+                                             static_cast<int>(late_periods);
+                scheduler->skipped_vblank_count += scheduler->skipped_vblanks;
+        }
+
+        return frame_scheduler_predict(scheduler,
+                                       static_cast<uint64_t>(present));
+}
+
+extern void frame_scheduler_will_swap(struct FrameScheduler* scheduler)
+{
+        uint64_t const now = clock_microseconds(scheduler->clock);
+        double const duration =
+                static_cast<double>(now - scheduler->frame_start_micros);
+
+        // follows slower frames faster than it recovers, while a single
+        // hitch does not make the following frames skip
+        double const smoothing = duration > scheduler->render_micros ?
+                                 4 * FRAME_SCHEDULER_SMOOTHING :
+                                 FRAME_SCHEDULER_SMOOTHING;
+        scheduler->render_micros +=
+                smoothing * (duration - scheduler->render_micros);
+}
+
+extern void frame_scheduler_did_swap(struct FrameScheduler* scheduler)
+{
+        uint64_t const now = clock_microseconds(scheduler->clock);
+        uint64_t const last_swap_micros = scheduler->last_swap_micros;
+        scheduler->last_swap_micros = now;
+        scheduler->frame_count++;
+
+        if (0 == last_swap_micros) {
+                return;
+        }
+
+        uint64_t const interval = now - last_swap_micros;
+        double const interval_micros = static_cast<double>(interval);
+        scheduler->interval_sum += interval_micros;
+        scheduler->interval_square_sum += interval_micros * interval_micros;
+        if (interval > scheduler->max_interval_micros) {
+                scheduler->max_interval_micros = interval;
+        }
+        scheduler->prediction_error_sum +=
+                fabs(static_cast<double>(now) - scheduler->present_micros);
+
+        if (0 == scheduler->swap_interval) {
+                return;
+        }
+
+        // intervals span a whole number of refresh periods
+        double const periods = floor(interval_micros /
+                                     scheduler->period_micros + 0.5);
+        if (periods < 1.0) {
+                return;
+        }
+        double const period_error =
+                interval_micros - periods * scheduler->period_micros;
+        if (fabs(period_error) < scheduler->period_micros / 4) {
+                scheduler->period_micros += FRAME_SCHEDULER_SMOOTHING *
+                                            period_error / periods;
+        }
+
+        int const expected_periods =
+                scheduler->swap_interval + scheduler->skipped_vblanks;
+        if (periods > expected_periods) {
+                scheduler->missed_vblank_count +=
+                        static_cast<uint64_t>(periods) - expected_periods;
+        }
+}
+
+extern void frame_scheduler_print_summary(
+        struct FrameScheduler const* scheduler)
+{
+        if (scheduler->frame_count < 2) {
+                return;
+        }
+
+        double const interval_count = scheduler->frame_count - 1;
+        double const mean = scheduler->interval_sum / interval_count;
+        double const variance =
+                scheduler->interval_square_sum / interval_count - mean * mean;
+
+        printf("video: %llu frames, %.2f Hz display, frame interval %.2fms "
+               "(jitter %.2fms, max %.2fms)\n",
+               static_cast<unsigned long long>(scheduler->frame_count),
+               1e6 / scheduler->period_micros, mean / 1000.0,
+               (variance > 0.0 ? sqrt(variance) : 0.0) / 1000.0,
+               scheduler->max_interval_micros / 1000.0);
+        printf("  %llu missed vblanks, %llu skipped vblanks, "
+               "presentation predicted within %.2fms\n",
+               static_cast<unsigned long long>(scheduler->missed_vblank_count),
+               static_cast<unsigned long long>(scheduler->skipped_vblank_count),
+               scheduler->prediction_error_sum / interval_count / 1000.0);
+}
@@ -0,0 +1,393 @@
+#include <algorithm> // std::sort
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strcmp
+
+#include <GL/glew.h>
+
+#include <micros/profile.h>
+
+#include "../clock.h"
+#include "../gl_profiler.h"
+
+enum {
+        // in flight before being read back, as many as the window lets the
+        // render thread run ahead of the gpu (MICROS_FRAMES_IN_FLIGHT)
+        GL_PROFILER_FRAME_COUNT = 8,
+        GL_PROFILER_MARK_COUNT = 128, // scopes per frame
+        GL_PROFILER_SCOPE_COUNT = 64,
+        GL_PROFILER_STACK_DEPTH = 16,
+        GL_PROFILER_SAMPLE_COUNT = 128, // for the rolling statistics
+};
+
+/// a scope and its last samples, in microseconds
+struct GlProfilerScope {
+        char const* name;
+        int parent; // -1 for the frame
+        int depth;
+        uint32_t sample_count;
+        float gpu_samples[GL_PROFILER_SAMPLE_COUNT];
+        float cpu_samples[GL_PROFILER_SAMPLE_COUNT];
+};
+
+/// an instance of a scope within a frame
+struct GlProfilerMark {
+        int scope;
+        uint64_t cpu_begin_micros;
+        uint64_t cpu_end_micros;
+};
+
+struct GlProfilerFrame {
+        bool is_pending;
+        GLuint frame_queries[2]; // timestamps at its begin and end
+        GLuint timestamp_queries[2 * GL_PROFILER_MARK_COUNT];
+        uint64_t cpu_micros;
+        int mark_count;
+        struct GlProfilerMark marks[GL_PROFILER_MARK_COUNT];
+};
+
+struct GlProfiler {
+        struct Clock* clock;
+        bool has_timer_query;
+        uint64_t frame_index;
+        uint64_t frame_start_micros;
+        uint64_t dropped_frame_count; // whose results were not ready
+
+        int stack[GL_PROFILER_STACK_DEPTH]; // open marks
+        int stack_size;
+
+        int scope_count;
+        struct GlProfilerScope scopes[GL_PROFILER_SCOPE_COUNT];
+        struct GlProfilerFrame frames[GL_PROFILER_FRAME_COUNT];
+};
+
+/// the profiler of the frame being rendered, if any
+static struct GlProfiler* gl_profiler_current;
+
+/// @return the frame being rendered, or the one offset frames after it
+static struct GlProfilerFrame* gl_profiler_frame(struct GlProfiler* profiler,
+                uint64_t offset)
+{
+        uint64_t const index = profiler->frame_index + offset;
+        return &profiler->frames[index % GL_PROFILER_FRAME_COUNT];
+}
+
+static int gl_profiler_find_scope(struct GlProfiler* profiler,
+                                  char const* name,
+                                  int parent)
+{
+        for (int i = 0; i < profiler->scope_count; i++) {
+                struct GlProfilerScope const* scope = &profiler->scopes[i];
+                if (scope->parent == parent &&
+                    (scope->name == name || 0 == strcmp(scope->name, name))) {
+                        return i;
+                }
+        }
+
+        if (profiler->scope_count == GL_PROFILER_SCOPE_COUNT) {
+                return -1;
+        }
+        int const index = profiler->scope_count++;
+        struct GlProfilerScope* scope = &profiler->scopes[index];
+        scope->name = name;
+        scope->parent = parent;
+        scope->depth = parent < 0 ? 0 : profiler->scopes[parent].depth + 1;
+        scope->sample_count = 0;
+        return index;
+}
+
+static void gl_profiler_add_sample(struct GlProfilerScope* scope,
+                                   float gpu_micros,
+                                   float cpu_micros)
+{
+        uint32_t const index = scope->sample_count++ % GL_PROFILER_SAMPLE_COUNT;
+        scope->gpu_samples[index] = gpu_micros;
+        scope->cpu_samples[index] = cpu_micros;
+}
+
+/// reads back the results of a frame, unless it would wait for the gpu
+static void gl_profiler_collect(struct GlProfiler* profiler,
+                                struct GlProfilerFrame* frame)
+{
+        frame->is_pending = false;
+
+        GLuint64 frame_begin_nanos = 0;
+        GLuint64 frame_end_nanos = 0;
+        if (profiler->has_timer_query) {
+                // the end of the frame comes after all of its scopes
+                GLint is_available = 0;
+                glGetQueryObjectiv(frame->frame_queries[1],
+                                   GL_QUERY_RESULT_AVAILABLE, &is_available);
+                if (!is_available) {
+                        profiler->dropped_frame_count++;
+                        return;
+                }
+                glGetQueryObjectui64v(frame->frame_queries[0], GL_QUERY_RESULT,
+                                      &frame_begin_nanos);
+                glGetQueryObjectui64v(frame->frame_queries[1], GL_QUERY_RESULT,
+                                      &frame_end_nanos);
+        }
+
+        gl_profiler_add_sample(&profiler->scopes[0],
+                               (frame_end_nanos - frame_begin_nanos) / 1000.0f,
+                               static_cast<float>(frame->cpu_micros));
+
+        for (int i = 0; i < frame->mark_count; i++) {
+                struct GlProfilerMark const* mark = &frame->marks[i];
+                GLuint const* queries = &frame->timestamp_queries[2 * i];
+                GLuint64 gpu_begin_nanos = 0;
+                GLuint64 gpu_end_nanos = 0;
+                if (profiler->has_timer_query) {
+                        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT,
+                                              &gpu_begin_nanos);
+                        glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT,
+                                              &gpu_end_nanos);
+                }
+                float const gpu_micros =
+                        (gpu_end_nanos - gpu_begin_nanos) / 1000.0f;
+                uint64_t const cpu_micros =
+                        mark->cpu_end_micros - mark->cpu_begin_micros;
+                gl_profiler_add_sample(&profiler->scopes[mark->scope],
+                                       gpu_micros,
+                                       static_cast<float>(cpu_micros));
+        }
+}
+
+extern struct GlProfiler* gl_profiler_create(struct Clock* clock)
+{
+        char const* profile = getenv("MICROS_PROFILE");
+        if (!profile || atoi(profile) <= 0) {
+                return NULL;
+        }
+
+        struct GlProfiler* profiler = new GlProfiler;
+        profiler->clock = clock;
+        profiler->has_timer_query = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+        profiler->frame_index = 0;
+        profiler->frame_start_micros = 0;
+        profiler->dropped_frame_count = 0;
+        profiler->stack_size = 0;
+        profiler->scope_count = 0;
+        gl_profiler_find_scope(profiler, "frame", -1);
+
+        for (int i = 0; i < GL_PROFILER_FRAME_COUNT; i++) {
+                struct GlProfilerFrame* frame = &profiler->frames[i];
+                frame->is_pending = false;
+                frame->mark_count = 0;
+                if (profiler->has_timer_query) {
+                        glGenQueries(2, frame->frame_queries);
+                        glGenQueries(2 * GL_PROFILER_MARK_COUNT,
+                                     frame->timestamp_queries);
+                }
+        }
+
+        printf("profiler: measuring %s time of frames and scopes\n",
+               profiler->has_timer_query ? "gpu and cpu" : "cpu");
+        return profiler;
+}
+
+extern void gl_profiler_destroy(struct GlProfiler* profiler)
+{
+        if (!profiler) {
+                return;
+        }
+
+        // the last frames, read back from the oldest on
+        glFinish();
+        uint64_t const oldest_index =
+                profiler->frame_index < GL_PROFILER_FRAME_COUNT ?
+                0 : profiler->frame_index - GL_PROFILER_FRAME_COUNT;
+        for (uint64_t index = oldest_index; index < profiler->frame_index;
+             index++) {
+                struct GlProfilerFrame* frame =
+                        &profiler->frames[index % GL_PROFILER_FRAME_COUNT];
+                if (frame->is_pending) {
+                        gl_profiler_collect(profiler, frame);
+                }
+        }
+        gl_profiler_print_summary(profiler);
+
+        if (profiler->has_timer_query) {
+                for (int i = 0; i < GL_PROFILER_FRAME_COUNT; i++) {
+                        struct GlProfilerFrame* frame = &profiler->frames[i];
+                        glDeleteQueries(2, frame->frame_queries);
+                        glDeleteQueries(2 * GL_PROFILER_MARK_COUNT,
+                                        frame->timestamp_queries);
+                }
+        }
+        if (gl_profiler_current == profiler) {
+                gl_profiler_current = NULL;
+        }
+        delete profiler;
+}
+
+extern void gl_profiler_begin_frame(struct GlProfiler* profiler)
+{
+        if (!profiler) {
+                return;
+        }
+
+        struct GlProfilerFrame* frame = gl_profiler_frame(profiler, 0);
+        if (frame->is_pending) {
+                gl_profiler_collect(profiler, frame);
+        }
+
+        frame->mark_count = 0;
+        profiler->stack_size = 0;
+        profiler->frame_start_micros = clock_microseconds(profiler->clock);
+        if (profiler->has_timer_query) {
+                glQueryCounter(frame->frame_queries[0], GL_TIMESTAMP);
+        }
+        gl_profiler_current = profiler;
+}
+
+extern void gl_profiler_end_frame(struct GlProfiler* profiler)
+{
+        if (!profiler) {
+                return;
+        }
+
+        // closes the scopes the demo left open
+        while (profiler->stack_size) {
+                profile_scope_end();
+        }
+        gl_profiler_current = NULL;
+
+        struct GlProfilerFrame* frame = gl_profiler_frame(profiler, 0);
+        if (profiler->has_timer_query) {
+                glQueryCounter(frame->frame_queries[1], GL_TIMESTAMP);
+                // submits the queries even when no swap follows
+                glFlush();
+        }
+        frame->cpu_micros = clock_microseconds(profiler->clock) -
+                            profiler->frame_start_micros;
+        frame->is_pending = true;
+        profiler->frame_index++;
+}
+
+extern void profile_scope_begin(char const* name)
+{
+        struct GlProfiler* profiler = gl_profiler_current;
+        if (!profiler) {
+                return;
+        }
+
+        if (profiler->stack_size >= GL_PROFILER_STACK_DEPTH) {
+                // too deep, counted as part of its parent
+                profiler->stack_size++;
+                return;
+        }
+
+        struct GlProfilerFrame* frame = gl_profiler_frame(profiler, 0);
+        int const parent_mark = profiler->stack_size ?
+                                profiler->stack[profiler->stack_size - 1] : -1;
+        int const parent = parent_mark < 0 ?
+                           0 : frame->marks[parent_mark].scope;
+        int const scope = gl_profiler_find_scope(profiler, name, parent);
+
+        // past the limits, the scope is counted as part of its parent
+        int mark_index = -1;
+        if (scope >= 0 && frame->mark_count < GL_PROFILER_MARK_COUNT) {
+                mark_index = frame->mark_count++;
+                struct GlProfilerMark* mark = &frame->marks[mark_index];
+                mark->scope = scope;
+                mark->cpu_begin_micros = clock_microseconds(profiler->clock);
+                if (profiler->has_timer_query) {
+                        glQueryCounter(frame->timestamp_queries[2 * mark_index],
+                                       GL_TIMESTAMP);
+                }
+        }
+
+        profiler->stack[profiler->stack_size] = mark_index < 0 ?
+                                                parent_mark : mark_index;
+        profiler->stack_size++;
+}
+
+extern void profile_scope_end()
+{
+        struct GlProfiler* profiler = gl_profiler_current;
+        if (!profiler || 0 == profiler->stack_size) {
+                return;
+        }
+
+        struct GlProfilerFrame* frame = gl_profiler_frame(profiler, 0);
+        profiler->stack_size--;
+        if (profiler->stack_size >= GL_PROFILER_STACK_DEPTH) {
+                return;
+        }
+
+        int const mark_index = profiler->stack[profiler->stack_size];
+        int const parent_mark = profiler->stack_size ?
+                                profiler->stack[profiler->stack_size - 1] : -1;
+        if (mark_index < 0 || mark_index == parent_mark) {
+                return;
+        }
+
+        struct GlProfilerMark* mark = &frame->marks[mark_index];
+        mark->cpu_end_micros = clock_microseconds(profiler->clock);
+        if (profiler->has_timer_query) {
+                glQueryCounter(frame->timestamp_queries[2 * mark_index + 1],
+                               GL_TIMESTAMP);
+        }
+}
+
+/// average and percentiles of the last samples
+static void gl_profiler_print_samples(char const* label,
+                                      float const* samples,
+                                      uint32_t sample_count)
+{
+        float sorted[GL_PROFILER_SAMPLE_COUNT];
+        double sum = 0.0;
+        for (uint32_t i = 0; i < sample_count; i++) {
+                sorted[i] = samples[i];
+                sum += samples[i];
+        }
+        std::sort(sorted, sorted + sample_count);
+
+        printf(" %s %7.3f avg %7.3f p50 %7.3f p95 %7.3f p99", label,
+               sum / sample_count / 1000.0,
+               sorted[sample_count * 50 / 100] / 1000.0,
+               sorted[sample_count * 95 / 100] / 1000.0,
+               sorted[sample_count * 99 / 100] / 1000.0);
+}
+
+/// prints a scope, then its children
+static void gl_profiler_print_scope(struct GlProfiler const* profiler,
+                                    int index)
+{
+        struct GlProfilerScope const* scope = &profiler->scopes[index];
+        if (scope->sample_count) {
+                uint32_t const window = GL_PROFILER_SAMPLE_COUNT;
+                uint32_t const sample_count = scope->sample_count < window ?
+                                              scope->sample_count : window;
+
+                printf("  %*s%-*s", 2 * scope->depth, "",
+                       24 - 2 * scope->depth, scope->name);
+                if (profiler->has_timer_query) {
+                        gl_profiler_print_samples("gpu", scope->gpu_samples,
+                                                  sample_count);
+                }
+                gl_profiler_print_samples("cpu", scope->cpu_samples,
+                                          sample_count);
+                printf("\n");
+        }
+
+        for (int i = index + 1; i < profiler->scope_count; i++) {
+                if (profiler->scopes[i].parent == index) {
+                        gl_profiler_print_scope(profiler, i);
+                }
+        }
+}
+
+extern void gl_profiler_print_summary(struct GlProfiler* profiler)
+{
+        if (!profiler || 0 == profiler->scopes[0].sample_count) {
+                return;
+        }
+
+        printf("profile of the last %d frames in ms (%llu frames, %llu not "
+               "read back in time):\n", GL_PROFILER_SAMPLE_COUNT,
+               static_cast<unsigned long long>(profiler->frame_index),
+               static_cast<unsigned long long>(profiler->dropped_frame_count));
+        gl_profiler_print_scope(profiler, 0);
+}
@@ -0,0 +1,87 @@
+/**
+ * \file
+ *
+ * Offline rendering: drives the audio entry point faster than
+ * realtime, with time derived from the sample position rather than the
+ * wall clock.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "../audio_render.h"
+#include "../clock.h"
+#include "../offline_render.h"
+#include "../wav_writer.h"
+
+static uint64_t offline_render_duration_micros()
+{
+        char const* seconds = getenv("MICROS_RENDER_SECONDS");
+        double const duration_seconds = seconds ? atof(seconds) : 60.0;
+        if (duration_seconds <= 0.0) {
+                return 0;
+        }
+        return static_cast<uint64_t>(duration_seconds * 1e6);
+}
+
+extern bool offline_render_audio(char const* wav_path,
+                                 uint64_t duration_micros,
+                                 struct Clock* clock)
+{
+        struct WavWriter writer;
+        if (wav_writer_open(&writer, wav_path)) {
+                printf("could not open %s for writing\n", wav_path);
+                return false;
+        }
+
+        int const block_frame_count = 1024;
+        float interleaved[2 * block_frame_count];
+
+        uint64_t const total_frame_count = duration_micros * 48000 / 1000000;
+        uint64_t const start_micros = clock_microseconds(clock);
+        uint64_t frame_position = 0;
+        bool success = true;
+        while (frame_position < total_frame_count) {
+                uint64_t const remaining_frames = total_frame_count - frame_position;
+                int const frame_count = remaining_frames < block_frame_count ?
+                                        static_cast<int>(remaining_frames) :
+                                        block_frame_count;
+
+                audio_render_2chn_f32(1000000 * frame_position / 48000,
+                                      frame_count,
+                                      interleaved);
+
+                if (wav_writer_write(&writer, interleaved, frame_count)) {
+                        printf("could not write to %s\n", wav_path);
+                        success = false;
+                        break;
+                }
+                frame_position += frame_count;
+        }
+        uint64_t const elapsed_micros = clock_microseconds(clock) - start_micros;
+
+        if (wav_writer_close(&writer)) {
+                printf("could not finalize %s\n", wav_path);
+                success = false;
+        }
+
+        double const rendered_seconds = frame_position / 48000.0;
+        double const elapsed_seconds = elapsed_micros / 1e6;
+        printf("rendered %.3fs of audio to %s in %.3fs (%.1fx realtime)\n",
+               rendered_seconds, wav_path, elapsed_seconds,
+               elapsed_seconds > 0.0 ? rendered_seconds / elapsed_seconds : 0.0);
+
+        return success;
+}
+
+extern bool run_offline_render(struct Clock* clock)
+{
+        char const* wav_path = getenv("MICROS_RENDER_AUDIO");
+        if (!wav_path) {
+                return false;
+        }
+
+        offline_render_audio(wav_path, offline_render_duration_micros(), clock);
+
+        return true;
+}
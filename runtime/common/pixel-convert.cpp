@@ -0,0 +1,254 @@
+/**
+ * \file
+ *
+ * RGBA to YUV 4:2:0 kernels, in scalar and SSE2 flavors.
+ *
+ * Both use the same 8bit fixed point coefficients, so that their
+ * results are identical. The SSE2 kernel converts 16 pixels of each
+ * row at a time and leaves the remainder to the scalar kernel.
+ */
+
+#include "../cpu_features.h"
+#include "../pixel_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PIXEL_CONVERT_X86 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define PIXEL_CONVERT_TARGET_SSE2
+#else
+#define PIXEL_CONVERT_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+
+static uint8_t pixel_luma(int r, int g, int b)
+{
+        return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+/// from sums of 4 pixels
+static void pixel_chroma(int r4, int g4, int b4, uint8_t* u, uint8_t* v)
+{
+        int const r = (r4 + 2) >> 2;
+        int const g = (g4 + 2) >> 2;
+        int const b = (b4 + 2) >> 2;
+
+        // the offset of 128 is added before the shift, which keeps the
+        // sums positive and rounds them like the SSE2 arithmetic shift
+        int const u_sum = -38 * r - 74 * g + 112 * b + 128 + (128 << 8);
+        int const v_sum = 112 * r - 94 * g - 18 * b + 128 + (128 << 8);
+        *u = static_cast<uint8_t>(u_sum >> 8);
+        *v = static_cast<uint8_t>(v_sum >> 8);
+}
+
+static void scalar_rgba_to_yuv420(uint8_t luma_row0[],
+                                  uint8_t luma_row1[],
+                                  uint8_t u_row[],
+                                  uint8_t v_row[],
+                                  uint8_t const rgba_row0[],
+                                  uint8_t const rgba_row1[],
+                                  int first_x,
+                                  int width)
+{
+        for (int x = first_x; x < width; x++) {
+                uint8_t const* p0 = &rgba_row0[4 * x];
+                uint8_t const* p1 = &rgba_row1[4 * x];
+                luma_row0[x] = pixel_luma(p0[0], p0[1], p0[2]);
+                luma_row1[x] = pixel_luma(p1[0], p1[1], p1[2]);
+        }
+
+        for (int x = first_x; x < width; x += 2) {
+                // the last column of odd widths stands for its neighbor
+                int const next_x = x + 1 < width ? x + 1 : x;
+                uint8_t const* p[] = {
+                        &rgba_row0[4 * x], &rgba_row0[4 * next_x],
+                        &rgba_row1[4 * x], &rgba_row1[4 * next_x],
+                };
+                int sums[3] = { 0, 0, 0 };
+                for (int i = 0; i < 4; i++) {
+                        for (int c = 0; c < 3; c++) {
+                                sums[c] += p[i][c];
+                        }
+                }
+                pixel_chroma(sums[0], sums[1], sums[2], &u_row[x / 2],
+                             &v_row[x / 2]);
+        }
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+/// splits 8 RGBA pixels into 16bit channels
+PIXEL_CONVERT_TARGET_SSE2
+static void sse2_unpack_rgb(uint8_t const rgba[], __m128i* r, __m128i* g,
+                            __m128i* b)
+{
+        __m128i const mask = _mm_set1_epi32(0xff);
+        __m128i const pixels0 =
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(rgba));
+        __m128i const pixels1 =
+                _mm_loadu_si128(reinterpret_cast<__m128i const*>(rgba + 16));
+
+        *r = _mm_packs_epi32(_mm_and_si128(pixels0, mask),
+                             _mm_and_si128(pixels1, mask));
+        *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(pixels0, 8), mask),
+                             _mm_and_si128(_mm_srli_epi32(pixels1, 8), mask));
+        *b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(pixels0, 16), mask),
+                             _mm_and_si128(_mm_srli_epi32(pixels1, 16), mask));
+}
+
+/// r * r_weight + g * g_weight + b * b_weight + 128, on 16bit
+PIXEL_CONVERT_TARGET_SSE2
+static __m128i sse2_weighted_sum(__m128i r, __m128i g, __m128i b,
+                                 short r_weight,
+                                 short g_weight,
+                                 short b_weight)
+{
+        __m128i const r_term = _mm_mullo_epi16(r, _mm_set1_epi16(r_weight));
+        __m128i const g_term = _mm_mullo_epi16(g, _mm_set1_epi16(g_weight));
+        __m128i const b_term = _mm_mullo_epi16(b, _mm_set1_epi16(b_weight));
+        return _mm_add_epi16(_mm_add_epi16(r_term, g_term),
+                             _mm_add_epi16(b_term, _mm_set1_epi16(128)));
+}
+
+/// the sums fit in 16bit once taken as unsigned
+PIXEL_CONVERT_TARGET_SSE2
+static __m128i sse2_luma(__m128i r, __m128i g, __m128i b)
+{
+        __m128i const sum = sse2_weighted_sum(r, g, b, 66, 129, 25);
+        return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+/// the sums fit in 16bit as signed values
+PIXEL_CONVERT_TARGET_SSE2
+static __m128i sse2_chroma(__m128i r, __m128i g, __m128i b,
+                           short r_weight,
+                           short g_weight,
+                           short b_weight)
+{
+        __m128i const sum =
+                sse2_weighted_sum(r, g, b, r_weight, g_weight, b_weight);
+        return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+/**
+ * rounded averages of the 2x2 blocks of 16 values of two rows, each
+ * split in a left and a right half.
+ */
+PIXEL_CONVERT_TARGET_SSE2
+static __m128i sse2_block_averages(__m128i row0_left, __m128i row0_right,
+                                   __m128i row1_left, __m128i row1_right)
+{
+        __m128i const ones = _mm_set1_epi16(1);
+        __m128i const left = _mm_madd_epi16(_mm_add_epi16(row0_left, row1_left),
+                                            ones);
+        __m128i const right =
+                _mm_madd_epi16(_mm_add_epi16(row0_right, row1_right), ones);
+        __m128i const sums = _mm_packs_epi32(left, right);
+        return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+PIXEL_CONVERT_TARGET_SSE2
+static void sse2_rgba_to_yuv420(uint8_t luma_row0[],
+                                uint8_t luma_row1[],
+                                uint8_t u_row[],
+                                uint8_t v_row[],
+                                uint8_t const rgba_row0[],
+                                uint8_t const rgba_row1[],
+                                int width)
+{
+        int const simd_width = width & ~15;
+        for (int x = 0; x < simd_width; x += 16) {
+                // left and right halves of the first, then second row
+                __m128i r[4], g[4], b[4];
+                sse2_unpack_rgb(&rgba_row0[4 * x], &r[0], &g[0], &b[0]);
+                sse2_unpack_rgb(&rgba_row0[4 * x + 32], &r[1], &g[1], &b[1]);
+                sse2_unpack_rgb(&rgba_row1[4 * x], &r[2], &g[2], &b[2]);
+                sse2_unpack_rgb(&rgba_row1[4 * x + 32], &r[3], &g[3], &b[3]);
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&luma_row0[x]),
+                                 _mm_packus_epi16(sse2_luma(r[0], g[0], b[0]),
+                                                  sse2_luma(r[1], g[1], b[1])));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&luma_row1[x]),
+                                 _mm_packus_epi16(sse2_luma(r[2], g[2], b[2]),
+                                                  sse2_luma(r[3], g[3], b[3])));
+
+                __m128i const r_average =
+                        sse2_block_averages(r[0], r[1], r[2], r[3]);
+                __m128i const g_average =
+                        sse2_block_averages(g[0], g[1], g[2], g[3]);
+                __m128i const b_average =
+                        sse2_block_averages(b[0], b[1], b[2], b[3]);
+
+                __m128i const u = sse2_chroma(r_average, g_average, b_average,
+                                              -38, -74, 112);
+                __m128i const v = sse2_chroma(r_average, g_average, b_average,
+                                              112, -94, -18);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(&u_row[x / 2]),
+                                 _mm_packus_epi16(u, u));
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(&v_row[x / 2]),
+                                 _mm_packus_epi16(v, v));
+        }
+
+        scalar_rgba_to_yuv420(luma_row0, luma_row1, u_row, v_row, rgba_row0,
+                              rgba_row1, simd_width, width);
+}
+
+#endif
+
+struct PixelConvertKernels {
+        char const* name;
+        void (*rgba_to_yuv420)(uint8_t*, uint8_t*, uint8_t*, uint8_t*,
+                               uint8_t const*, uint8_t const*, int);
+};
+
+static void scalar_rgba_to_yuv420_rows(uint8_t luma_row0[],
+                                       uint8_t luma_row1[],
+                                       uint8_t u_row[],
+                                       uint8_t v_row[],
+                                       uint8_t const rgba_row0[],
+                                       uint8_t const rgba_row1[],
+                                       int width)
+{
+        scalar_rgba_to_yuv420(luma_row0, luma_row1, u_row, v_row, rgba_row0,
+                              rgba_row1, 0, width);
+}
+
+static struct PixelConvertKernels pixel_convert_select_kernels()
+{
+#if defined(PIXEL_CONVERT_X86)
+        if (cpu_has_sse2()) {
+                struct PixelConvertKernels const sse2_kernels = {
+                        "sse2",
+                        sse2_rgba_to_yuv420,
+                };
+                return sse2_kernels;
+        }
+#endif
+
+        struct PixelConvertKernels const scalar_kernels = {
+                "scalar",
+                scalar_rgba_to_yuv420_rows,
+        };
+        return scalar_kernels;
+}
+
+static struct PixelConvertKernels const pixel_convert_kernels =
+        pixel_convert_select_kernels();
+
+extern void pixel_convert_rgba_to_yuv420(uint8_t luma_row0[],
+                uint8_t luma_row1[],
+                uint8_t u_row[],
+                uint8_t v_row[],
+                uint8_t const rgba_row0[],
+                uint8_t const rgba_row1[],
+                int width)
+{
+        pixel_convert_kernels.rgba_to_yuv420(luma_row0, luma_row1, u_row, v_row,
+                                             rgba_row0, rgba_row1, width);
+}
+
+extern char const* pixel_convert_implementation()
+{
+        return pixel_convert_kernels.name;
+}
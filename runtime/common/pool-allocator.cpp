@@ -0,0 +1,158 @@
+#include <cstdint> // uintptr_t
+#include <cstdio>
+#include <cstring> // memset
+
+#include "../allocator.h"
+#include "../pool_allocator.h"
+
+/// its address identifies the calling thread
+static thread_local char pool_allocator_thread_token;
+
+static bool pool_allocator_is_owner(struct PoolAllocator const* pool)
+{
+        return &pool_allocator_thread_token ==
+               pool->owner.load(std::memory_order_acquire);
+}
+
+static void* pool_size_class_pop(struct PoolSizeClass* size_class)
+{
+        void* block = size_class->local_free;
+        if (!block) {
+                block = size_class->remote_free.exchange(NULL,
+                                std::memory_order_acquire);
+        }
+        if (!block) {
+                return NULL;
+        }
+
+        size_class->local_free = *static_cast<void**>(block);
+        return block;
+}
+
+static void* pool_alloc(struct Allocator* self, size_t size)
+{
+        struct PoolAllocator* pool = reinterpret_cast<struct PoolAllocator*>(self);
+        if (!pool_allocator_is_owner(pool)) {
+                printf("pool allocator: only its owner thread may allocate\n");
+                return NULL;
+        }
+
+        for (int i = 0; i < POOL_ALLOCATOR_CLASS_COUNT; i++) {
+                struct PoolSizeClass* size_class = &pool->classes[i];
+                if (size_class->block_size < size) {
+                        continue;
+                }
+
+                // continue with the bigger classes when this one is empty
+                void* block = pool_size_class_pop(size_class);
+                if (block) {
+                        return block;
+                }
+        }
+
+        return NULL;
+}
+
+static void pool_free(struct Allocator* self, void* ptr)
+{
+        struct PoolAllocator* pool = reinterpret_cast<struct PoolAllocator*>(self);
+        if (!ptr) {
+                return;
+        }
+
+        char* const block = static_cast<char*>(ptr);
+        for (int i = 0; i < POOL_ALLOCATOR_CLASS_COUNT; i++) {
+                struct PoolSizeClass* size_class = &pool->classes[i];
+                if (block < size_class->begin || block >= size_class->end) {
+                        continue;
+                }
+
+                if (pool_allocator_is_owner(pool)) {
+                        *reinterpret_cast<void**>(block) = size_class->local_free;
+                        size_class->local_free = block;
+                        return;
+                }
+
+                void* head = size_class->remote_free.load(std::memory_order_relaxed);
+                do {
+                        *reinterpret_cast<void**>(block) = head;
+                } while (!size_class->remote_free.compare_exchange_weak(
+                                 head, block,
+                                 std::memory_order_release,
+                                 std::memory_order_relaxed));
+                return;
+        }
+
+        printf("pool allocator: %p was not allocated from this pool\n", ptr);
+}
+
+extern int pool_allocator_init(struct PoolAllocator* pool,
+                               struct Allocator* parent,
+                               size_t capacity,
+                               size_t block_padding)
+{
+        // classes start on page boundaries
+        size_t const page_size = POOL_ALLOCATOR_PAGE_SIZE;
+        size_t const class_capacity =
+                (capacity / POOL_ALLOCATOR_CLASS_COUNT) & ~(page_size - 1);
+        if (!class_capacity) {
+                return -1;
+        }
+        size_t const used_capacity =
+                POOL_ALLOCATOR_CLASS_COUNT * class_capacity;
+        char* memory = static_cast<char*>(
+                allocator_alloc(parent, used_capacity + page_size - 1));
+        if (!memory) {
+                return -1;
+        }
+        char* const aligned_memory = reinterpret_cast<char*>(
+                (reinterpret_cast<uintptr_t>(memory) + page_size - 1) &
+                ~static_cast<uintptr_t>(page_size - 1));
+        memset(aligned_memory, 0, used_capacity);
+
+        pool->allocator.alloc = pool_alloc;
+        pool->allocator.free = pool_free;
+        pool->parent = parent;
+        pool->memory = memory;
+        pool->owner.store(NULL);
+
+        char* class_memory = aligned_memory;
+        for (int i = 0; i < POOL_ALLOCATOR_CLASS_COUNT; i++) {
+                struct PoolSizeClass* size_class = &pool->classes[i];
+                size_t const block_size = (static_cast<size_t>(16) << i) +
+                                          block_padding;
+                size_t const block_count = class_capacity / block_size;
+
+                size_class->block_size = block_size;
+                size_class->begin = class_memory;
+                size_class->end = class_memory + block_count * block_size;
+                size_class->remote_free.store(NULL);
+
+                // thread the free list through the blocks, first one on top
+                void* next = NULL;
+                for (size_t j = block_count; j > 0; j--) {
+                        char* block = class_memory + (j - 1) * block_size;
+                        *reinterpret_cast<void**>(block) = next;
+                        next = block;
+                }
+                size_class->local_free = next;
+
+                class_memory += class_capacity;
+        }
+
+        return 0;
+}
+
+extern void pool_allocator_deinit(struct PoolAllocator* pool)
+{
+        allocator_free(pool->parent, pool->memory);
+        pool->memory = NULL;
+}
+
+extern void pool_allocator_claim(struct PoolAllocator* pool)
+{
+        if (!pool_allocator_is_owner(pool)) {
+                pool->owner.store(&pool_allocator_thread_token,
+                                  std::memory_order_release);
+        }
+}
@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strerror
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#endif
+
+#include <atomic>
+
+#include "../cpu_features.h"
+#include "../realtime_thread.h"
+
+static bool realtime_thread_set_priority(int priority)
+{
+        priority = priority < 1 ? 1 : priority > 99 ? 99 : priority;
+#if defined(_WIN32)
+        int const thread_priority = priority >= 50 ?
+                                    THREAD_PRIORITY_TIME_CRITICAL :
+                                    THREAD_PRIORITY_HIGHEST;
+        return 0 != SetThreadPriority(GetCurrentThread(), thread_priority);
+#else
+        int const min_priority = sched_get_priority_min(SCHED_FIFO);
+        int const max_priority = sched_get_priority_max(SCHED_FIFO);
+
+        // map onto the range of the system
+        struct sched_param param = {};
+        param.sched_priority = min_priority +
+                               (max_priority - min_priority) * (priority - 1) / 98;
+        int const err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err) {
+                printf("realtime scheduling denied: %s\n", strerror(err));
+        }
+        return 0 == err;
+#endif
+}
+
+static bool realtime_thread_set_cpu(int cpu)
+{
+#if defined(_WIN32)
+        if (cpu >= static_cast<int>(8 * sizeof(DWORD_PTR))) {
+                return false;
+        }
+        return 0 != SetThreadAffinityMask(GetCurrentThread(),
+                                          static_cast<DWORD_PTR>(1) << cpu);
+#elif defined(__linux__)
+        if (cpu >= CPU_SETSIZE) {
+                return false;
+        }
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        return 0 == pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+#elif defined(__APPLE__)
+        // only a hint: threads with different tags are spread over
+        // different caches, when the machine supports it at all
+        thread_affinity_policy_data_t policy = { cpu + 1 };
+        return KERN_SUCCESS ==
+               thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                                 THREAD_AFFINITY_POLICY,
+                                 reinterpret_cast<thread_policy_t>(&policy),
+                                 THREAD_AFFINITY_POLICY_COUNT);
+#else
+        return false;
+#endif
+}
+
+static bool realtime_thread_flush_denormals()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        if (!cpu_has_sse2()) {
+                return false;
+        }
+        unsigned int const flush_to_zero = 1u << 15;
+        unsigned int const denormals_are_zero = 1u << 6;
+        _mm_setcsr(_mm_getcsr() | flush_to_zero | denormals_are_zero);
+        return true;
+#elif defined(__aarch64__)
+        uint64_t fpcr;
+        __asm__ __volatile__ ("mrs %0, fpcr" : "=r"(fpcr));
+        fpcr |= static_cast<uint64_t>(1) << 24;
+        __asm__ __volatile__ ("msr fpcr, %0" : : "r"(fpcr));
+        return true;
+#else
+        return false;
+#endif
+}
+
+static bool realtime_thread_lock_memory()
+{
+#if defined(_WIN32)
+        // without an equivalent to mlockall, a larger working set keeps
+        // the pages of the process from being trimmed, and the stack of
+        // the calling thread is locked within it
+        HANDLE const process = GetCurrentProcess();
+        SIZE_T minimum, maximum;
+        if (!GetProcessWorkingSetSize(process, &minimum, &maximum)) {
+                return false;
+        }
+        SIZE_T const margin = static_cast<SIZE_T>(64) << 20;
+        if (!SetProcessWorkingSetSize(process, minimum + margin,
+                                      maximum + margin)) {
+                return false;
+        }
+        MEMORY_BASIC_INFORMATION stack;
+        if (!VirtualQuery(&stack, &stack, sizeof stack)) {
+                return false;
+        }
+        return 0 != VirtualLock(stack.BaseAddress, stack.RegionSize);
+#else
+        return 0 == mlockall(MCL_CURRENT | MCL_FUTURE);
+#endif
+}
+
+extern void realtime_thread_setup(char const* name,
+                                  int priority,
+                                  char const* cpu_variable)
+{
+        bool const has_priority = realtime_thread_set_priority(priority);
+
+        char const* cpu_value = getenv(cpu_variable);
+        int const cpu = cpu_value && cpu_value[0] ? atoi(cpu_value) : -1;
+        bool const has_cpu = cpu >= 0 && realtime_thread_set_cpu(cpu);
+        if (cpu >= 0 && !has_cpu) {
+                printf("could not pin %s thread to cpu %d\n", name, cpu);
+        }
+
+        bool const has_flush = realtime_thread_flush_denormals();
+
+        // memory is locked for the whole process, only once
+        static std::atomic<bool> memory_lock_requested;
+        char const* mlock_value = getenv("MICROS_MLOCK");
+        if (mlock_value && 0 == strcmp(mlock_value, "1") &&
+            !memory_lock_requested.exchange(true)) {
+                bool const has_memory_lock = realtime_thread_lock_memory();
+                printf("memory lock: %s\n", has_memory_lock ? "granted" : "denied");
+        }
+
+        printf("%s thread: %s priority, denormals %s",
+               name,
+               has_priority ? "realtime" : "normal",
+               has_flush ? "flushed to zero" : "kept");
+        if (has_cpu) {
+                printf(", pinned to cpu %d", cpu);
+        }
+        printf("\n");
+}
@@ -0,0 +1,548 @@
+/**
+ * \file
+ *
+ * Sample format conversion kernels, in scalar, SSE2 and AVX2 flavors.
+ *
+ * The SIMD kernels process whole groups of frames and leave the
+ * remainder to the scalar kernels. AVX2 kernels clear the upper ymm
+ * state before returning, to avoid penalizing the caller's SSE code.
+ */
+
+#include <cmath>
+
+#include "../cpu_features.h"
+#include "../sample_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SAMPLE_CONVERT_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define SAMPLE_CONVERT_TARGET_SSE2
+#define SAMPLE_CONVERT_TARGET_AVX2
+#else
+#define SAMPLE_CONVERT_TARGET_SSE2 __attribute__((target("sse2")))
+#define SAMPLE_CONVERT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static double const sample_convert_s16_scale = 32767.0;
+static double const sample_convert_s32_scale = 2147483647.0;
+
+static double sample_clip(double sample)
+{
+        return sample < -1.0 ? -1.0 : (sample > 1.0 ? 1.0 : sample);
+}
+
+static void scalar_f64_planar_to_f32(float interleaved[],
+                                     double const left[],
+                                     double const right[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                interleaved[2 * i] = (float) left[i];
+                interleaved[2 * i + 1] = (float) right[i];
+        }
+}
+
+static void scalar_f64_planar_to_s16(int16_t interleaved[],
+                                     double const left[],
+                                     double const right[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                interleaved[2 * i] = static_cast<int16_t>(
+                                             lrint(sample_clip(left[i]) * sample_convert_s16_scale));
+                interleaved[2 * i + 1] = static_cast<int16_t>(
+                                                 lrint(sample_clip(right[i]) * sample_convert_s16_scale));
+        }
+}
+
+static void scalar_f64_planar_to_s32(int32_t interleaved[],
+                                     double const left[],
+                                     double const right[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                interleaved[2 * i] = static_cast<int32_t>(
+                                             lrint(sample_clip(left[i]) * sample_convert_s32_scale));
+                interleaved[2 * i + 1] = static_cast<int32_t>(
+                                                 lrint(sample_clip(right[i]) * sample_convert_s32_scale));
+        }
+}
+
+static void scalar_f32_to_f64_planar(double left[],
+                                     double right[],
+                                     float const interleaved[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                left[i] = interleaved[2 * i];
+                right[i] = interleaved[2 * i + 1];
+        }
+}
+
+static void scalar_s16_to_f64_planar(double left[],
+                                     double right[],
+                                     int16_t const interleaved[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                left[i] = interleaved[2 * i] / sample_convert_s16_scale;
+                right[i] = interleaved[2 * i + 1] / sample_convert_s16_scale;
+        }
+}
+
+static void scalar_s32_to_f64_planar(double left[],
+                                     double right[],
+                                     int32_t const interleaved[],
+                                     int frame_count)
+{
+        for (int i = 0; i < frame_count; i++) {
+                left[i] = interleaved[2 * i] / sample_convert_s32_scale;
+                right[i] = interleaved[2 * i + 1] / sample_convert_s32_scale;
+        }
+}
+
+static void scalar_f32_to_s16(int16_t dest[],
+                              float const source[],
+                              int sample_count)
+{
+        float const scale = static_cast<float>(sample_convert_s16_scale);
+        for (int i = 0; i < sample_count; i++) {
+                float const sample = source[i] < -1.0f ? -1.0f :
+                                     (source[i] > 1.0f ? 1.0f : source[i]);
+                dest[i] = static_cast<int16_t>(lrintf(sample * scale));
+        }
+}
+
+#if defined(SAMPLE_CONVERT_X86)
+
+SAMPLE_CONVERT_TARGET_SSE2
+static __m128d sse2_clip_pd(__m128d samples)
+{
+        return _mm_min_pd(_mm_max_pd(samples, _mm_set1_pd(-1.0)), _mm_set1_pd(1.0));
+}
+
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_f64_planar_to_f32(float interleaved[],
+                                   double const left[],
+                                   double const right[],
+                                   int frame_count)
+{
+        int i = 0;
+        for (; i + 2 <= frame_count; i += 2) {
+                __m128 const l = _mm_cvtpd_ps(_mm_loadu_pd(&left[i]));
+                __m128 const r = _mm_cvtpd_ps(_mm_loadu_pd(&right[i]));
+                _mm_storeu_ps(&interleaved[2 * i], _mm_unpacklo_ps(l, r));
+        }
+        scalar_f64_planar_to_f32(&interleaved[2 * i], &left[i], &right[i],
+                                 frame_count - i);
+}
+
+/// two frames of clipped and scaled samples, as [l0 r0 l1 r1] integers
+SAMPLE_CONVERT_TARGET_SSE2
+static __m128i sse2_scaled_pair_epi32(double const left[],
+                                      double const right[],
+                                      __m128d scale)
+{
+        __m128i const l = _mm_cvtpd_epi32(_mm_mul_pd(sse2_clip_pd(_mm_loadu_pd(left)),
+                                          scale));
+        __m128i const r = _mm_cvtpd_epi32(_mm_mul_pd(sse2_clip_pd(_mm_loadu_pd(right)),
+                                          scale));
+        return _mm_unpacklo_epi32(l, r);
+}
+
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_f64_planar_to_s16(int16_t interleaved[],
+                                   double const left[],
+                                   double const right[],
+                                   int frame_count)
+{
+        __m128d const scale = _mm_set1_pd(sample_convert_s16_scale);
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m128i const first = sse2_scaled_pair_epi32(&left[i], &right[i], scale);
+                __m128i const second = sse2_scaled_pair_epi32(&left[i + 2], &right[i + 2],
+                                       scale);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&interleaved[2 * i]),
+                                 _mm_packs_epi32(first, second));
+        }
+        scalar_f64_planar_to_s16(&interleaved[2 * i], &left[i], &right[i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_f64_planar_to_s32(int32_t interleaved[],
+                                   double const left[],
+                                   double const right[],
+                                   int frame_count)
+{
+        __m128d const scale = _mm_set1_pd(sample_convert_s32_scale);
+        int i = 0;
+        for (; i + 2 <= frame_count; i += 2) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&interleaved[2 * i]),
+                                 sse2_scaled_pair_epi32(&left[i], &right[i], scale));
+        }
+        scalar_f64_planar_to_s32(&interleaved[2 * i], &left[i], &right[i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_f32_to_f64_planar(double left[],
+                                   double right[],
+                                   float const interleaved[],
+                                   int frame_count)
+{
+        int i = 0;
+        for (; i + 2 <= frame_count; i += 2) {
+                __m128 const lrlr = _mm_loadu_ps(&interleaved[2 * i]);
+                __m128 const llrr = _mm_shuffle_ps(lrlr, lrlr, _MM_SHUFFLE(3, 1, 2, 0));
+                _mm_storeu_pd(&left[i], _mm_cvtps_pd(llrr));
+                _mm_storeu_pd(&right[i], _mm_cvtps_pd(_mm_movehl_ps(llrr, llrr)));
+        }
+        scalar_f32_to_f64_planar(&left[i], &right[i], &interleaved[2 * i],
+                                 frame_count - i);
+}
+
+/// converts two frames of [l0 r0 l1 r1] integers
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_store_epi32_pair(double left[],
+                                  double right[],
+                                  __m128i lrlr,
+                                  __m128d scale)
+{
+        __m128i const llrr = _mm_shuffle_epi32(lrlr, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_pd(left, _mm_div_pd(_mm_cvtepi32_pd(llrr), scale));
+        _mm_storeu_pd(right, _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(llrr, 8)),
+                                        scale));
+}
+
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_s16_to_f64_planar(double left[],
+                                   double right[],
+                                   int16_t const interleaved[],
+                                   int frame_count)
+{
+        __m128d const scale = _mm_set1_pd(sample_convert_s16_scale);
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m128i const samples = _mm_loadu_si128(
+                                                reinterpret_cast<__m128i const*>(&interleaved[2 * i]));
+                // sign extension to 32bit
+                __m128i const first = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+                __m128i const second = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+                sse2_store_epi32_pair(&left[i], &right[i], first, scale);
+                sse2_store_epi32_pair(&left[i + 2], &right[i + 2], second, scale);
+        }
+        scalar_s16_to_f64_planar(&left[i], &right[i], &interleaved[2 * i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_s32_to_f64_planar(double left[],
+                                   double right[],
+                                   int32_t const interleaved[],
+                                   int frame_count)
+{
+        __m128d const scale = _mm_set1_pd(sample_convert_s32_scale);
+        int i = 0;
+        for (; i + 2 <= frame_count; i += 2) {
+                __m128i const samples = _mm_loadu_si128(
+                                                reinterpret_cast<__m128i const*>(&interleaved[2 * i]));
+                sse2_store_epi32_pair(&left[i], &right[i], samples, scale);
+        }
+        scalar_s32_to_f64_planar(&left[i], &right[i], &interleaved[2 * i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_SSE2
+static void sse2_f32_to_s16(int16_t dest[],
+                            float const source[],
+                            int sample_count)
+{
+        __m128 const scale = _mm_set1_ps(static_cast<float>(sample_convert_s16_scale));
+        __m128 const lowest = _mm_set1_ps(-1.0f);
+        __m128 const highest = _mm_set1_ps(1.0f);
+        int i = 0;
+        for (; i + 8 <= sample_count; i += 8) {
+                __m128 const first = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&source[i]), lowest),
+                                                highest);
+                __m128 const second = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&source[i + 4]),
+                                                 lowest), highest);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]),
+                                 _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(first, scale)),
+                                                 _mm_cvtps_epi32(_mm_mul_ps(second, scale))));
+        }
+        scalar_f32_to_s16(&dest[i], &source[i], sample_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_AVX2
+static __m256d avx2_clip_pd(__m256d samples)
+{
+        return _mm256_min_pd(_mm256_max_pd(samples, _mm256_set1_pd(-1.0)),
+                             _mm256_set1_pd(1.0));
+}
+
+SAMPLE_CONVERT_TARGET_AVX2
+static void avx2_f64_planar_to_f32(float interleaved[],
+                                   double const left[],
+                                   double const right[],
+                                   int frame_count)
+{
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m128 const l = _mm256_cvtpd_ps(_mm256_loadu_pd(&left[i]));
+                __m128 const r = _mm256_cvtpd_ps(_mm256_loadu_pd(&right[i]));
+                _mm_storeu_ps(&interleaved[2 * i], _mm_unpacklo_ps(l, r));
+                _mm_storeu_ps(&interleaved[2 * i + 4], _mm_unpackhi_ps(l, r));
+        }
+        _mm256_zeroupper();
+        scalar_f64_planar_to_f32(&interleaved[2 * i], &left[i], &right[i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_AVX2
+static void avx2_f64_planar_to_s16(int16_t interleaved[],
+                                   double const left[],
+                                   double const right[],
+                                   int frame_count)
+{
+        __m256d const scale = _mm256_set1_pd(sample_convert_s16_scale);
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m128i const l = _mm256_cvtpd_epi32(
+                                          _mm256_mul_pd(avx2_clip_pd(_mm256_loadu_pd(&left[i])), scale));
+                __m128i const r = _mm256_cvtpd_epi32(
+                                          _mm256_mul_pd(avx2_clip_pd(_mm256_loadu_pd(&right[i])), scale));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&interleaved[2 * i]),
+                                 _mm_packs_epi32(_mm_unpacklo_epi32(l, r),
+                                                 _mm_unpackhi_epi32(l, r)));
+        }
+        _mm256_zeroupper();
+        scalar_f64_planar_to_s16(&interleaved[2 * i], &left[i], &right[i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_AVX2
+static void avx2_f64_planar_to_s32(int32_t interleaved[],
+                                   double const left[],
+                                   double const right[],
+                                   int frame_count)
+{
+        __m256d const scale = _mm256_set1_pd(sample_convert_s32_scale);
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m128i const l = _mm256_cvtpd_epi32(
+                                          _mm256_mul_pd(avx2_clip_pd(_mm256_loadu_pd(&left[i])), scale));
+                __m128i const r = _mm256_cvtpd_epi32(
+                                          _mm256_mul_pd(avx2_clip_pd(_mm256_loadu_pd(&right[i])), scale));
+                __m256i const lrlr = _mm256_inserti128_si256(
+                                             _mm256_castsi128_si256(_mm_unpacklo_epi32(l, r)),
+                                             _mm_unpackhi_epi32(l, r), 1);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(&interleaved[2 * i]), lrlr);
+        }
+        _mm256_zeroupper();
+        scalar_f64_planar_to_s32(&interleaved[2 * i], &left[i], &right[i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_AVX2
+static void avx2_f32_to_f64_planar(double left[],
+                                   double right[],
+                                   float const interleaved[],
+                                   int frame_count)
+{
+        __m256i const deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m256 const llrr = _mm256_permutevar8x32_ps(
+                                            _mm256_loadu_ps(&interleaved[2 * i]), deinterleave);
+                _mm256_storeu_pd(&left[i], _mm256_cvtps_pd(_mm256_castps256_ps128(llrr)));
+                _mm256_storeu_pd(&right[i], _mm256_cvtps_pd(_mm256_extractf128_ps(llrr, 1)));
+        }
+        _mm256_zeroupper();
+        scalar_f32_to_f64_planar(&left[i], &right[i], &interleaved[2 * i],
+                                 frame_count - i);
+}
+
+/// converts four frames of [l0 r0 l1 r1 l2 r2 l3 r3] integers
+SAMPLE_CONVERT_TARGET_AVX2
+static void avx2_store_epi32_quad(double left[],
+                                  double right[],
+                                  __m256i lrlr,
+                                  __m256d scale)
+{
+        __m256i const llrr = _mm256_permutevar8x32_epi32(
+                                     lrlr, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+        _mm256_storeu_pd(left, _mm256_div_pd(
+                                 _mm256_cvtepi32_pd(_mm256_castsi256_si128(llrr)), scale));
+        _mm256_storeu_pd(right, _mm256_div_pd(
+                                 _mm256_cvtepi32_pd(_mm256_extracti128_si256(llrr, 1)), scale));
+}
+
+SAMPLE_CONVERT_TARGET_AVX2
+static void avx2_s16_to_f64_planar(double left[],
+                                   double right[],
+                                   int16_t const interleaved[],
+                                   int frame_count)
+{
+        __m256d const scale = _mm256_set1_pd(sample_convert_s16_scale);
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m128i const samples = _mm_loadu_si128(
+                                                reinterpret_cast<__m128i const*>(&interleaved[2 * i]));
+                avx2_store_epi32_quad(&left[i], &right[i], _mm256_cvtepi16_epi32(samples),
+                                      scale);
+        }
+        _mm256_zeroupper();
+        scalar_s16_to_f64_planar(&left[i], &right[i], &interleaved[2 * i],
+                                 frame_count - i);
+}
+
+SAMPLE_CONVERT_TARGET_AVX2
+static void avx2_s32_to_f64_planar(double left[],
+                                   double right[],
+                                   int32_t const interleaved[],
+                                   int frame_count)
+{
+        __m256d const scale = _mm256_set1_pd(sample_convert_s32_scale);
+        int i = 0;
+        for (; i + 4 <= frame_count; i += 4) {
+                __m256i const samples = _mm256_loadu_si256(
+                                                reinterpret_cast<__m256i const*>(&interleaved[2 * i]));
+                avx2_store_epi32_quad(&left[i], &right[i], samples, scale);
+        }
+        _mm256_zeroupper();
+        scalar_s32_to_f64_planar(&left[i], &right[i], &interleaved[2 * i],
+                                 frame_count - i);
+}
+
+#endif
+
+struct SampleConvertKernels {
+        char const* name;
+        void (*f64_planar_to_f32)(float*, double const*, double const*, int);
+        void (*f64_planar_to_s16)(int16_t*, double const*, double const*, int);
+        void (*f64_planar_to_s32)(int32_t*, double const*, double const*, int);
+        void (*f32_to_f64_planar)(double*, double*, float const*, int);
+        void (*s16_to_f64_planar)(double*, double*, int16_t const*, int);
+        void (*s32_to_f64_planar)(double*, double*, int32_t const*, int);
+        void (*f32_to_s16)(int16_t*, float const*, int);
+};
+
+static struct SampleConvertKernels sample_convert_select_kernels()
+{
+#if defined(SAMPLE_CONVERT_X86)
+        if (cpu_has_avx2()) {
+                struct SampleConvertKernels const avx2_kernels = {
+                        "avx2",
+                        avx2_f64_planar_to_f32,
+                        avx2_f64_planar_to_s16,
+                        avx2_f64_planar_to_s32,
+                        avx2_f32_to_f64_planar,
+                        avx2_s16_to_f64_planar,
+                        avx2_s32_to_f64_planar,
+                        sse2_f32_to_s16,
+                };
+                return avx2_kernels;
+        }
+
+        if (cpu_has_sse2()) {
+                struct SampleConvertKernels const sse2_kernels = {
+                        "sse2",
+                        sse2_f64_planar_to_f32,
+                        sse2_f64_planar_to_s16,
+                        sse2_f64_planar_to_s32,
+                        sse2_f32_to_f64_planar,
+                        sse2_s16_to_f64_planar,
+                        sse2_s32_to_f64_planar,
+                        sse2_f32_to_s16,
+                };
+                return sse2_kernels;
+        }
+#endif
+
+        struct SampleConvertKernels const scalar_kernels = {
+                "scalar",
+                scalar_f64_planar_to_f32,
+                scalar_f64_planar_to_s16,
+                scalar_f64_planar_to_s32,
+                scalar_f32_to_f64_planar,
+                scalar_s16_to_f64_planar,
+                scalar_s32_to_f64_planar,
+                scalar_f32_to_s16,
+        };
+        return scalar_kernels;
+}
+
+// selected once before main, as the audio threads must not wait on it
+static struct SampleConvertKernels const sample_convert_kernels =
+        sample_convert_select_kernels();
+
+extern void sample_convert_f64_planar_to_f32(float interleaved[],
+                double const left[],
+                double const right[],
+                int frame_count)
+{
+        sample_convert_kernels.f64_planar_to_f32(interleaved, left, right,
+                        frame_count);
+}
+
+extern void sample_convert_f64_planar_to_s16(int16_t interleaved[],
+                double const left[],
+                double const right[],
+                int frame_count)
+{
+        sample_convert_kernels.f64_planar_to_s16(interleaved, left, right,
+                        frame_count);
+}
+
+extern void sample_convert_f64_planar_to_s32(int32_t interleaved[],
+                double const left[],
+                double const right[],
+                int frame_count)
+{
+        sample_convert_kernels.f64_planar_to_s32(interleaved, left, right,
+                        frame_count);
+}
+
+extern void sample_convert_f32_to_f64_planar(double left[],
+                double right[],
+                float const interleaved[],
+                int frame_count)
+{
+        sample_convert_kernels.f32_to_f64_planar(left, right, interleaved,
+                        frame_count);
+}
+
+extern void sample_convert_s16_to_f64_planar(double left[],
+                double right[],
+                int16_t const interleaved[],
+                int frame_count)
+{
+        sample_convert_kernels.s16_to_f64_planar(left, right, interleaved,
+                        frame_count);
+}
+
+extern void sample_convert_s32_to_f64_planar(double left[],
+                double right[],
+                int32_t const interleaved[],
+                int frame_count)
+{
+        sample_convert_kernels.s32_to_f64_planar(left, right, interleaved,
+                        frame_count);
+}
+
+extern void sample_convert_f32_to_s16(int16_t dest[],
+                                      float const source[],
+                                      int sample_count)
+{
+        sample_convert_kernels.f32_to_s16(dest, source, sample_count);
+}
+
+extern char const* sample_convert_implementation()
+{
+        return sample_convert_kernels.name;
+}
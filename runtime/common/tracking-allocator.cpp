@@ -0,0 +1,329 @@
+#include <atomic>
+#include <cstddef> // max_align_t
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strcmp
+#include <new>
+
+#include <micros/api.h>
+
+#include "../allocator.h"
+#include "../tracking_allocator.h"
+
+enum {
+        TRACKING_TAG_COUNT = 16, // per thread
+        TRACKING_SIZE_BUCKET_COUNT = 24, // up to 16, 32, ... 128MiB and more
+};
+
+struct TrackingStats {
+        char const* tag;
+        std::atomic<int64_t> live_bytes;
+        std::atomic<int64_t> peak_bytes;
+        std::atomic<uint64_t> allocation_count;
+        std::atomic<uint64_t> audio_allocation_count;
+        std::atomic<uint64_t> size_histogram[TRACKING_SIZE_BUCKET_COUNT];
+};
+
+/// statistics of a thread, kept after it ends for the summary
+struct TrackingThread {
+        int index;
+        std::atomic<bool> has_rendered_audio;
+        struct TrackingThread* next;
+        std::atomic<int> stats_count;
+        struct TrackingStats stats[TRACKING_TAG_COUNT];
+};
+
+/// prefixes allocations, keeping their alignment
+struct alignas(alignof(std::max_align_t)) TrackingHeader {
+        struct TrackingStats* stats;
+        size_t size;
+};
+
+static std::atomic<struct TrackingThread*> tracking_threads;
+static std::atomic<int> tracking_thread_count;
+
+static thread_local struct TrackingThread* tracking_thread;
+static thread_local bool tracking_is_in_audio;
+
+static struct TrackingThread* tracking_current_thread()
+{
+        struct TrackingThread* thread = tracking_thread;
+        if (thread) {
+                return thread;
+        }
+
+        // not from an allocator, which may be the one behind operator new
+        void* memory = malloc(sizeof *thread);
+        if (!memory) {
+                return NULL;
+        }
+        thread = new (memory) TrackingThread();
+        thread->index = tracking_thread_count.fetch_add(1);
+
+        struct TrackingThread* head = tracking_threads.load();
+        do {
+                thread->next = head;
+        } while (!tracking_threads.compare_exchange_weak(head, thread));
+
+        tracking_thread = thread;
+        return thread;
+}
+
+static struct TrackingStats* tracking_stats(char const* tag)
+{
+        struct TrackingThread* thread = tracking_current_thread();
+        if (!thread) {
+                return NULL;
+        }
+
+        int const stats_count = thread->stats_count.load(std::memory_order_relaxed);
+        for (int i = 0; i < stats_count; i++) {
+                if (0 == strcmp(thread->stats[i].tag, tag)) {
+                        return &thread->stats[i];
+                }
+        }
+
+        if (stats_count == TRACKING_TAG_COUNT) {
+                return NULL;
+        }
+
+        thread->stats[stats_count].tag = tag;
+        thread->stats_count.store(stats_count + 1, std::memory_order_release);
+        return &thread->stats[stats_count];
+}
+
+static int tracking_size_bucket(size_t size)
+{
+        int bucket = 0;
+        size_t bucket_max_size = 16;
+        while (bucket < TRACKING_SIZE_BUCKET_COUNT - 1 && size > bucket_max_size) {
+                bucket++;
+                bucket_max_size *= 2;
+        }
+        return bucket;
+}
+
+static void* tracking_alloc(struct Allocator* self, size_t size)
+{
+        struct TrackingAllocator* tracking =
+                reinterpret_cast<struct TrackingAllocator*>(self);
+
+        char* memory = static_cast<char*>(
+                               allocator_alloc(tracking->parent,
+                                               sizeof(struct TrackingHeader) + size));
+        if (!memory) {
+                return NULL;
+        }
+
+        struct TrackingStats* stats = tracking_stats(tracking->tag);
+        struct TrackingHeader* header = reinterpret_cast<struct TrackingHeader*>(memory);
+        header->stats = stats;
+        header->size = size;
+
+        if (stats) {
+                int64_t const live_bytes = stats->live_bytes.fetch_add(
+                                                   static_cast<int64_t>(size),
+                                                   std::memory_order_relaxed) + static_cast<int64_t>(size);
+                int64_t peak_bytes = stats->peak_bytes.load(std::memory_order_relaxed);
+                while (live_bytes > peak_bytes &&
+                       !stats->peak_bytes.compare_exchange_weak(
+                               peak_bytes, live_bytes, std::memory_order_relaxed)) {
+                }
+
+                stats->allocation_count.fetch_add(1, std::memory_order_relaxed);
+                stats->size_histogram[tracking_size_bucket(size)].fetch_add(
+                        1, std::memory_order_relaxed);
+
+                if (tracking_is_in_audio) {
+                        uint64_t const audio_count = stats->audio_allocation_count.fetch_add(
+                                                             1, std::memory_order_relaxed);
+                        if (0 == audio_count && !tracking->is_realtime_safe) {
+                                printf("memory: %llu bytes allocated from '%s' during audio rendering\n",
+                                       static_cast<unsigned long long>(size), tracking->tag);
+                        }
+                }
+        }
+
+        return memory + sizeof(struct TrackingHeader);
+}
+
+static void tracking_free(struct Allocator* self, void* ptr)
+{
+        struct TrackingAllocator* tracking =
+                reinterpret_cast<struct TrackingAllocator*>(self);
+        if (!ptr) {
+                return;
+        }
+
+        char* memory = static_cast<char*>(ptr) - sizeof(struct TrackingHeader);
+        struct TrackingHeader const* header =
+                reinterpret_cast<struct TrackingHeader*>(memory);
+        if (header->stats) {
+                header->stats->live_bytes.fetch_sub(static_cast<int64_t>(header->size),
+                                                    std::memory_order_relaxed);
+        }
+
+        allocator_free(tracking->parent, memory);
+}
+
+extern void print_memory_stats()
+{
+        printf("memory: per thread and tag, live/peak bytes, allocations (during audio), sizes up to\n");
+
+        for (struct TrackingThread* thread = tracking_threads.load();
+             thread; thread = thread->next) {
+                int const stats_count = thread->stats_count.load(std::memory_order_acquire);
+                for (int i = 0; i < stats_count; i++) {
+                        struct TrackingStats const* stats = &thread->stats[i];
+                        printf("  thread %d%s, %s: %lld/%lld bytes, %llu (%llu),",
+                               thread->index,
+                               thread->has_rendered_audio.load(std::memory_order_relaxed) ?
+                               " (audio)" : "",
+                               stats->tag,
+                               static_cast<long long>(stats->live_bytes.load()),
+                               static_cast<long long>(stats->peak_bytes.load()),
+                               static_cast<unsigned long long>(stats->allocation_count.load()),
+                               static_cast<unsigned long long>(stats->audio_allocation_count.load()));
+
+                        for (int bucket = 0; bucket < TRACKING_SIZE_BUCKET_COUNT; bucket++) {
+                                uint64_t const count = stats->size_histogram[bucket].load();
+                                if (count) {
+                                        printf(" %llu%s:%llu",
+                                               static_cast<unsigned long long>(16) << bucket,
+                                               bucket == TRACKING_SIZE_BUCKET_COUNT - 1 ? "+" : "",
+                                               static_cast<unsigned long long>(count));
+                                }
+                        }
+                        printf("\n");
+                }
+        }
+}
+
+extern bool tracking_allocator_is_enabled()
+{
+#if defined(MICROS_TRACK_NEW)
+        return true;
+#else
+        static bool const is_enabled = [] {
+                char const* value = getenv("MICROS_TRACK_MEMORY");
+                return value && 0 == strcmp(value, "1");
+        }();
+        return is_enabled;
+#endif
+}
+
+extern void tracking_allocator_init(struct TrackingAllocator* tracking,
+                                    struct Allocator* parent,
+                                    char const* tag,
+                                    bool is_realtime_safe)
+{
+        static std::atomic<bool> has_summary;
+        if (!has_summary.exchange(true)) {
+                atexit(print_memory_stats);
+        }
+
+        tracking->allocator.alloc = tracking_alloc;
+        tracking->allocator.free = tracking_free;
+        tracking->parent = parent;
+        tracking->tag = tag;
+        tracking->is_realtime_safe = is_realtime_safe;
+}
+
+extern struct Allocator* tracking_allocator_wrap(
+        struct TrackingAllocator* tracking,
+        struct Allocator* allocator,
+        char const* tag,
+        bool is_realtime_safe)
+{
+        if (!tracking_allocator_is_enabled()) {
+                return allocator;
+        }
+
+        tracking_allocator_init(tracking, allocator, tag, is_realtime_safe);
+        return &tracking->allocator;
+}
+
+extern size_t tracking_allocator_overhead()
+{
+        return tracking_allocator_is_enabled() ? sizeof(struct TrackingHeader) : 0;
+}
+
+extern void tracking_allocator_prepare_thread()
+{
+        if (tracking_allocator_is_enabled()) {
+                tracking_current_thread();
+        }
+}
+
+extern void tracking_allocator_release_all(struct TrackingAllocator* tracking)
+{
+        struct TrackingStats* stats = tracking_stats(tracking->tag);
+        if (stats) {
+                stats->live_bytes.store(0, std::memory_order_relaxed);
+        }
+}
+
+extern void tracking_allocator_begin_audio()
+{
+        tracking_is_in_audio = true;
+        if (!tracking_allocator_is_enabled()) {
+                return;
+        }
+
+        struct TrackingThread* thread = tracking_current_thread();
+        if (thread) {
+                thread->has_rendered_audio.store(true, std::memory_order_relaxed);
+        }
+}
+
+extern void tracking_allocator_end_audio()
+{
+        tracking_is_in_audio = false;
+}
+
+#if defined(MICROS_TRACK_NEW)
+
+static void* tracking_heap_alloc(struct Allocator* self, size_t size)
+{
+        return malloc(size);
+}
+
+static void tracking_heap_free(struct Allocator* self, void* ptr)
+{
+        free(ptr);
+}
+
+static struct Allocator tracking_heap = {
+        tracking_heap_alloc, tracking_heap_free,
+};
+
+// constant initialized, so usable before any constructor runs
+static struct TrackingAllocator tracking_new = {
+        { tracking_alloc, tracking_free }, &tracking_heap, "operator new", false,
+};
+
+void* operator new(size_t size)
+{
+        void* ptr = allocator_alloc(&tracking_new.allocator, size ? size : 1);
+        if (!ptr) {
+                throw std::bad_alloc();
+        }
+        return ptr;
+}
+
+void* operator new[](size_t size)
+{
+        return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+        allocator_free(&tracking_new.allocator, ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+        operator delete(ptr);
+}
+
+#endif
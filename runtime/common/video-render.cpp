@@ -0,0 +1,72 @@
+/**
+ * \file
+ *
+ * Delegates video rendering to the demo's entry points.
+ *
+ * Both entry points are optional, like the audio ones: the runtime
+ * calls render_next_frame_gl3, whose default definition calls
+ * render_next_gl3 with the fields it has always received.
+ */
+
+#include <micros/api.h>
+
+#include "../video_render.h"
+
+#if defined(_MSC_VER)
+
+// Visual Studio has no weak symbols, the defaults are aliased to the
+// entry points' decorated names instead.
+
+extern void default_render_next_frame_gl3(struct FrameInfo const* frame_info)
+{
+        render_next_gl3(frame_info->time_micros, frame_info->display);
+}
+
+extern void default_render_next_gl3(uint64_t time_micros,
+                                    struct Display display)
+{
+}
+
+#if defined(_M_X64)
+#pragma comment(linker, "/alternatename:?render_next_frame_gl3@@YAXPEBUFrameInfo@@@Z=?default_render_next_frame_gl3@@YAXPEBUFrameInfo@@@Z")
+#else
+#pragma comment(linker, "/alternatename:?render_next_frame_gl3@@YAXPBUFrameInfo@@@Z=?default_render_next_frame_gl3@@YAXPBUFrameInfo@@@Z")
+#endif
+#pragma comment(linker, "/alternatename:?render_next_gl3@@YAX_KUDisplay@@@Z=?default_render_next_gl3@@YAX_KUDisplay@@@Z")
+
+#else
+
+extern __attribute__((weak))
+void render_next_frame_gl3(struct FrameInfo const* frame_info)
+{
+        render_next_gl3(frame_info->time_micros, frame_info->display);
+}
+
+extern __attribute__((weak))
+void render_next_gl3(uint64_t time_micros, struct Display display)
+{
+}
+
+#endif
+
+extern void video_render_init(struct VideoRender* render)
+{
+        render->frame_count = 0;
+        render->last_time_micros = 0;
+}
+
+extern void video_render_frame(struct VideoRender* render,
+                               struct FrameInfo* frame_info)
+{
+        uint64_t const time_micros = frame_info->time_micros;
+        frame_info->version = MICROS_FRAME_INFO_VERSION;
+        frame_info->size = sizeof *frame_info;
+        frame_info->frame_index = render->frame_count;
+        frame_info->delta_micros =
+                render->frame_count && time_micros >= render->last_time_micros ?
+                time_micros - render->last_time_micros : 0;
+
+        render->frame_count++;
+        render->last_time_micros = time_micros;
+        render_next_frame_gl3(frame_info);
+}
@@ -0,0 +1,249 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "../allocator.h"
+#include "../clock.h"
+#include "../virtual_clock.h"
+
+static uint64_t const VIRTUAL_CLOCK_RATE_ONE = 65536;
+
+struct VirtualClockMapping {
+        uint64_t clock_origin_micros;
+        uint64_t origin_micros;
+        uint64_t rate;
+};
+
+static struct VirtualClockMapping virtual_clock_read_mapping(
+        struct VirtualClock const* virtual_clock)
+{
+        struct VirtualClockMapping mapping;
+        for (;;) {
+                uint32_t const sequence =
+                        virtual_clock->sequence.load(std::memory_order_acquire);
+                if (sequence & 1) {
+                        continue;
+                }
+
+                mapping.clock_origin_micros = virtual_clock->clock_origin_micros.load(
+                                                      std::memory_order_relaxed);
+                mapping.origin_micros =
+                        virtual_clock->origin_micros.load(std::memory_order_relaxed);
+                mapping.rate = virtual_clock->rate.load(std::memory_order_relaxed);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence ==
+                    virtual_clock->sequence.load(std::memory_order_relaxed)) {
+                        return mapping;
+                }
+        }
+}
+
+static void virtual_clock_write_mapping(struct VirtualClock* virtual_clock,
+                                        struct VirtualClockMapping mapping)
+{
+        uint32_t const sequence =
+                virtual_clock->sequence.load(std::memory_order_relaxed);
+        virtual_clock->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        virtual_clock->clock_origin_micros.store(mapping.clock_origin_micros,
+                        std::memory_order_relaxed);
+        virtual_clock->origin_micros.store(mapping.origin_micros,
+                                           std::memory_order_relaxed);
+        virtual_clock->rate.store(mapping.rate, std::memory_order_relaxed);
+
+        virtual_clock->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+static uint64_t virtual_clock_apply(struct VirtualClockMapping mapping,
+                                    uint64_t clock_micros)
+{
+        if (clock_micros >= mapping.clock_origin_micros) {
+                return mapping.origin_micros +
+                       (clock_micros - mapping.clock_origin_micros) * mapping.rate /
+                       VIRTUAL_CLOCK_RATE_ONE;
+        }
+
+        // times from before the last change, i.e. audio rendered late
+        uint64_t const delta_micros =
+                (mapping.clock_origin_micros - clock_micros) * mapping.rate /
+                VIRTUAL_CLOCK_RATE_ONE;
+        return delta_micros < mapping.origin_micros ?
+               mapping.origin_micros - delta_micros : 0;
+}
+
+/// current demo time; in fixed step mode, the time of the last frame
+static uint64_t virtual_clock_current(struct VirtualClock const* virtual_clock,
+                                      struct VirtualClockMapping mapping)
+{
+        if (virtual_clock->step_micros) {
+                return mapping.origin_micros;
+        }
+        return virtual_clock_apply(mapping,
+                                   clock_microseconds(virtual_clock->clock));
+}
+
+/// restarts the mapping from the given demo time
+static void virtual_clock_reanchor(struct VirtualClock* virtual_clock,
+                                   uint64_t origin_micros,
+                                   uint64_t rate)
+{
+        struct VirtualClockMapping mapping;
+        mapping.clock_origin_micros = clock_microseconds(virtual_clock->clock);
+        mapping.origin_micros = origin_micros;
+        mapping.rate = rate;
+        virtual_clock_write_mapping(virtual_clock, mapping);
+}
+
+static double virtual_clock_getenv(char const* name, double default_value)
+{
+        char const* value = getenv(name);
+        return value && value[0] ? atof(value) : default_value;
+}
+
+extern bool virtual_clock_is_requested()
+{
+        char const* virtual_clock = getenv("MICROS_VIRTUAL_CLOCK");
+        return virtual_clock && atoi(virtual_clock) > 0;
+}
+
+extern int virtual_clock_init(struct VirtualClock** virtual_clockp,
+                              struct Allocator* allocator,
+                              struct Clock* clock)
+{
+        void* memory = allocator_alloc(allocator, sizeof(struct VirtualClock));
+        if (!memory) {
+                return -1;
+        }
+
+        struct VirtualClock* virtual_clock = new (memory) VirtualClock;
+        virtual_clock->allocator = allocator;
+        virtual_clock->clock = clock;
+        virtual_clock->sequence.store(0);
+
+        double const start_seconds = virtual_clock_getenv("MICROS_TIME_START", 0.0);
+        double const rate = virtual_clock_getenv("MICROS_TIME_RATE", 1.0);
+        double const step_fps = virtual_clock_getenv("MICROS_TIME_STEP_FPS", 0.0);
+
+        virtual_clock->step_micros = step_fps > 0.0 ?
+                                     static_cast<uint64_t>(1e6 / step_fps) : 0;
+        virtual_clock->unpaused_rate = VIRTUAL_CLOCK_RATE_ONE;
+        virtual_clock->frame_micros = 0;
+        virtual_clock->must_resync_frame = true;
+
+        virtual_clock_reanchor(virtual_clock,
+                               start_seconds > 0.0 ?
+                               static_cast<uint64_t>(1e6 * start_seconds) : 0,
+                               VIRTUAL_CLOCK_RATE_ONE);
+        virtual_clock_set_rate(virtual_clock, rate);
+
+        *virtual_clockp = virtual_clock;
+        printf("virtual clock: starting at %.3fs, rate %.3f", start_seconds,
+               virtual_clock_rate(virtual_clock));
+        if (virtual_clock->step_micros) {
+                printf(", fixed step of %lluus",
+                       static_cast<unsigned long long>(virtual_clock->step_micros));
+        }
+        printf("\n");
+
+        return 0;
+}
+
+extern void virtual_clock_deinit(struct VirtualClock** virtual_clockp)
+{
+        struct VirtualClock* virtual_clock = *virtual_clockp;
+        struct Allocator* allocator = virtual_clock->allocator;
+        virtual_clock->~VirtualClock();
+        allocator_free(allocator, virtual_clock);
+        *virtual_clockp = 0;
+}
+
+extern uint64_t virtual_clock_micros(struct VirtualClock const* virtual_clock)
+{
+        return virtual_clock_current(virtual_clock,
+                                     virtual_clock_read_mapping(virtual_clock));
+}
+
+extern uint64_t virtual_clock_map(struct VirtualClock const* virtual_clock,
+                                  uint64_t clock_micros,
+                                  bool* is_paused)
+{
+        struct VirtualClockMapping const mapping =
+                virtual_clock_read_mapping(virtual_clock);
+        if (is_paused) {
+                *is_paused = 0 == mapping.rate;
+        }
+        return virtual_clock_apply(mapping, clock_micros);
+}
+
+extern uint64_t virtual_clock_next_frame(struct VirtualClock* virtual_clock,
+                uint64_t present_micros)
+{
+        if (!virtual_clock->step_micros) {
+                return virtual_clock_map(virtual_clock, present_micros, NULL);
+        }
+
+        struct VirtualClockMapping const mapping =
+                virtual_clock_read_mapping(virtual_clock);
+        if (virtual_clock->must_resync_frame) {
+                virtual_clock->must_resync_frame = false;
+                virtual_clock->frame_micros = mapping.origin_micros;
+        } else {
+                virtual_clock->frame_micros +=
+                        virtual_clock->step_micros * mapping.rate /
+                        VIRTUAL_CLOCK_RATE_ONE;
+        }
+
+        // audio continues from the frame at the current rate
+        virtual_clock_reanchor(virtual_clock, virtual_clock->frame_micros,
+                               mapping.rate);
+        return virtual_clock->frame_micros;
+}
+
+extern void virtual_clock_toggle_pause(struct VirtualClock* virtual_clock)
+{
+        struct VirtualClockMapping const mapping =
+                virtual_clock_read_mapping(virtual_clock);
+        uint64_t const now_micros = virtual_clock_current(virtual_clock, mapping);
+
+        if (mapping.rate) {
+                virtual_clock->unpaused_rate = mapping.rate;
+                virtual_clock_reanchor(virtual_clock, now_micros, 0);
+        } else {
+                virtual_clock_reanchor(virtual_clock, now_micros,
+                                       virtual_clock->unpaused_rate);
+        }
+}
+
+extern void virtual_clock_seek(struct VirtualClock* virtual_clock,
+                               uint64_t micros)
+{
+        struct VirtualClockMapping const mapping =
+                virtual_clock_read_mapping(virtual_clock);
+        virtual_clock_reanchor(virtual_clock, micros, mapping.rate);
+        virtual_clock->must_resync_frame = true;
+}
+
+extern void virtual_clock_set_rate(struct VirtualClock* virtual_clock,
+                                   double rate)
+{
+        rate = rate < 1.0 / 64 ? 1.0 / 64 : rate > 64.0 ? 64.0 : rate;
+        uint64_t const fixed_rate =
+                static_cast<uint64_t>(rate * VIRTUAL_CLOCK_RATE_ONE + 0.5);
+
+        struct VirtualClockMapping const mapping =
+                virtual_clock_read_mapping(virtual_clock);
+        virtual_clock->unpaused_rate = fixed_rate;
+        if (mapping.rate) {
+                uint64_t const now_micros =
+                        virtual_clock_current(virtual_clock, mapping);
+                virtual_clock_reanchor(virtual_clock, now_micros, fixed_rate);
+        }
+}
+
+extern double virtual_clock_rate(struct VirtualClock const* virtual_clock)
+{
+        uint64_t const rate = virtual_clock_read_mapping(virtual_clock).rate;
+        return static_cast<double>(rate) / VIRTUAL_CLOCK_RATE_ONE;
+}
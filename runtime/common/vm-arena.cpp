@@ -0,0 +1,347 @@
+/**
+ * \file
+ *
+ * Virtual memory arenas, and the arena behind asset_allocator().
+ *
+ * The asset arena reserves MICROS_ASSET_ARENA_BYTES of address space
+ * (1GiB by default) the first time it is asked for. MICROS_HUGE_PAGES
+ * selects its pages: "off", "transparent" (the default) or "explicit",
+ * which needs huge pages reserved in /proc/sys/vm/nr_hugepages.
+ *
+ * Windows has no transparent huge pages. Its large pages, for
+ * "explicit", need the "Lock pages in memory" right and are committed
+ * and locked as soon as they are reserved: size the arena accordingly.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring> // strcmp
+
+#if defined(_WIN32)
+#include <windows.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "advapi32.lib") // for AdjustTokenPrivileges
+#endif
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <micros/api.h>
+
+#include "../vm_arena.h"
+
+static size_t const VM_ARENA_ALIGNMENT = 16;
+static size_t const VM_ARENA_HUGE_PAGE_SIZE = 2 << 20;
+
+static size_t vm_arena_round_up(size_t size, size_t granularity)
+{
+        return (size + granularity - 1) / granularity * granularity;
+}
+
+static size_t vm_arena_page_size()
+{
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+/// makes [offset, offset + size) of the arena usable
+static bool vm_arena_commit(struct VmArena* arena, size_t offset, size_t size)
+{
+#if defined(_WIN32)
+        if (VM_ARENA_PAGES_EXPLICIT_HUGE == arena->pages) {
+                // large pages were committed with the reservation
+                return true;
+        }
+        return NULL != VirtualAlloc(arena->base + offset, size, MEM_COMMIT,
+                                    PAGE_READWRITE);
+#else
+#if defined(MAP_HUGETLB)
+        if (VM_ARENA_PAGES_EXPLICIT_HUGE == arena->pages) {
+                // replaces the reserved range, failing when the pool of
+                // huge pages is exhausted rather than faulting later
+                void* memory = mmap(arena->base + offset, size,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED |
+                                    MAP_HUGETLB, -1, 0);
+                return MAP_FAILED != memory;
+        }
+#endif
+        return 0 == mprotect(arena->base + offset, size,
+                             PROT_READ | PROT_WRITE);
+#endif
+}
+
+#if defined(_WIN32)
+/// large pages need SeLockMemoryPrivilege, granted but disabled by default
+static bool vm_arena_enable_lock_memory_privilege()
+{
+        HANDLE token;
+        if (!OpenProcessToken(GetCurrentProcess(),
+                              TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+                return false;
+        }
+
+        TOKEN_PRIVILEGES privileges = {};
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        bool const is_enabled =
+                LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+                                     &privileges.Privileges[0].Luid) &&
+                AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL,
+                                      NULL) &&
+                ERROR_SUCCESS == GetLastError(); // or ERROR_NOT_ALL_ASSIGNED
+        CloseHandle(token);
+        return is_enabled;
+}
+#endif
+
+/// reserves size bytes of address space, aligned on alignment
+static char* vm_arena_reserve(size_t size, size_t alignment,
+                              enum VmArenaPages pages)
+{
+#if defined(_WIN32)
+        // reservations are aligned on 64KiB, and large pages on their size
+        (void) alignment;
+        if (VM_ARENA_PAGES_TRANSPARENT_HUGE == pages) {
+                return NULL;
+        }
+        if (VM_ARENA_PAGES_EXPLICIT_HUGE == pages) {
+                SIZE_T const large_page_size = GetLargePageMinimum();
+                if (!large_page_size || size % large_page_size ||
+                    !vm_arena_enable_lock_memory_privilege()) {
+                        return NULL;
+                }
+                DWORD const allocation_type =
+                        MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+                return static_cast<char*>(VirtualAlloc(NULL, size,
+                                                       allocation_type,
+                                                       PAGE_READWRITE));
+        }
+        return static_cast<char*>(VirtualAlloc(NULL, size, MEM_RESERVE,
+                                               PAGE_NOACCESS));
+#else
+        if (VM_ARENA_PAGES_EXPLICIT_HUGE == pages) {
+#if defined(MAP_HUGETLB)
+                // checks that the system has huge pages to give
+                void* page = mmap(NULL, VM_ARENA_HUGE_PAGE_SIZE,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                                  -1, 0);
+                if (MAP_FAILED == page) {
+                        return NULL;
+                }
+                munmap(page, VM_ARENA_HUGE_PAGE_SIZE);
+#else
+                return NULL;
+#endif
+        }
+
+        // over-reserve to align the start, then give back the excess
+        size_t const padded_size = size + alignment;
+        void* memory = mmap(NULL, padded_size, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (MAP_FAILED == memory) {
+                return NULL;
+        }
+
+        char* const start = static_cast<char*>(memory);
+        uintptr_t const start_address = reinterpret_cast<uintptr_t>(start);
+        char* const base = reinterpret_cast<char*>(
+                                   vm_arena_round_up(start_address, alignment));
+        if (base > start) {
+                munmap(start, base - start);
+        }
+        size_t const tail_size = start + padded_size - (base + size);
+        if (tail_size) {
+                munmap(base + size, tail_size);
+        }
+
+#if defined(MADV_HUGEPAGE)
+        if (VM_ARENA_PAGES_TRANSPARENT_HUGE == pages) {
+                madvise(base, size, MADV_HUGEPAGE);
+        }
+#endif
+
+        return base;
+#endif
+}
+
+static void* vm_arena_alloc(struct Allocator* self, size_t size)
+{
+        struct VmArena* arena = reinterpret_cast<struct VmArena*>(self);
+
+        size_t const offset = vm_arena_round_up(arena->used,
+                                                VM_ARENA_ALIGNMENT);
+        if (offset > arena->reserved || size > arena->reserved - offset) {
+                return NULL;
+        }
+
+        char* const ptr = arena->base + offset;
+        size_t const last_offset = arena->last_offset;
+        size_t const used = arena->used;
+        arena->last_offset = offset;
+        arena->used = offset;
+        if (!vm_arena_grow(arena, ptr, size)) {
+                arena->last_offset = last_offset;
+                arena->used = used;
+                return NULL;
+        }
+        return ptr;
+}
+
+static void vm_arena_free(struct Allocator* self, void* ptr)
+{
+        // released all at once, by vm_arena_reset
+        (void) self;
+        (void) ptr;
+}
+
+extern int vm_arena_init(struct VmArena* arena,
+                         size_t reserved,
+                         enum VmArenaPages pages)
+{
+        char* base = NULL;
+        for (int i = pages; !base && i >= VM_ARENA_PAGES_SMALL; i--) {
+                pages = static_cast<enum VmArenaPages>(i);
+                size_t const granularity = VM_ARENA_PAGES_SMALL == pages ?
+                                           vm_arena_page_size() :
+                                           VM_ARENA_HUGE_PAGE_SIZE;
+                reserved = vm_arena_round_up(reserved, granularity);
+                base = vm_arena_reserve(reserved, granularity, pages);
+        }
+        if (!base) {
+                return -1;
+        }
+
+        arena->allocator.alloc = vm_arena_alloc;
+        arena->allocator.free = vm_arena_free;
+        arena->base = base;
+        arena->reserved = reserved;
+        arena->committed = 0;
+        arena->used = 0;
+        arena->last_offset = 0;
+        // commit huge pages whole, and small ones in batches
+        arena->commit_granularity = VM_ARENA_PAGES_SMALL == pages ?
+                                    16 * vm_arena_page_size() :
+                                    VM_ARENA_HUGE_PAGE_SIZE;
+        arena->pages = pages;
+
+        return 0;
+}
+
+extern void vm_arena_deinit(struct VmArena* arena)
+{
+#if defined(_WIN32)
+        VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+        munmap(arena->base, arena->reserved);
+#endif
+        arena->base = NULL;
+        arena->reserved = 0;
+        arena->committed = 0;
+        arena->used = 0;
+}
+
+extern void vm_arena_reset(struct VmArena* arena)
+{
+        arena->used = 0;
+        arena->last_offset = 0;
+}
+
+extern bool vm_arena_grow(struct VmArena* arena, void* ptr, size_t size)
+{
+        size_t const offset = static_cast<char*>(ptr) - arena->base;
+        if (offset != arena->last_offset ||
+            size > arena->reserved - offset) {
+                return false;
+        }
+
+        size_t const end = offset + size;
+        if (end > arena->committed) {
+                size_t const committed =
+                        vm_arena_round_up(end, arena->commit_granularity);
+                size_t const commit_end = committed < arena->reserved ?
+                                          committed : arena->reserved;
+                if (!vm_arena_commit(arena, arena->committed,
+                                     commit_end - arena->committed)) {
+                        printf("could not commit %llu bytes of memory\n",
+                               static_cast<unsigned long long>(commit_end));
+                        return false;
+                }
+                arena->committed = commit_end;
+        }
+
+        arena->used = end;
+        return true;
+}
+
+static struct VmArena asset_arena;
+static bool asset_arena_is_initialized;
+
+static enum VmArenaPages asset_arena_pages()
+{
+        char const* pages = getenv("MICROS_HUGE_PAGES");
+        if (pages && 0 == strcmp(pages, "off")) {
+                return VM_ARENA_PAGES_SMALL;
+        }
+        if (pages && 0 == strcmp(pages, "explicit")) {
+                return VM_ARENA_PAGES_EXPLICIT_HUGE;
+        }
+        return VM_ARENA_PAGES_TRANSPARENT_HUGE;
+}
+
+static size_t asset_arena_reserved()
+{
+        char const* bytes = getenv("MICROS_ASSET_ARENA_BYTES");
+        long long const reserved = bytes ? atoll(bytes) : 0;
+        if (reserved > 0) {
+                return static_cast<size_t>(reserved);
+        }
+        return sizeof(void*) >= 8 ? static_cast<size_t>(1) << 30 : 256 << 20;
+}
+
+extern struct Allocator* asset_allocator()
+{
+        if (!asset_arena_is_initialized) {
+                char const* const page_names[] = {
+                        "small", "transparent huge", "explicit huge",
+                };
+                size_t const reserved = asset_arena_reserved();
+                enum VmArenaPages const pages = asset_arena_pages();
+                if (vm_arena_init(&asset_arena, reserved, pages)) {
+                        // an empty arena, whose allocations all fail
+                        printf("could not reserve asset arena of %llu bytes\n",
+                               static_cast<unsigned long long>(reserved));
+                        asset_arena.allocator.alloc = vm_arena_alloc;
+                        asset_arena.allocator.free = vm_arena_free;
+                } else {
+                        unsigned long long const reserved_bytes =
+                                asset_arena.reserved;
+                        printf("asset arena: reserved %llu bytes, %s pages\n",
+                               reserved_bytes, page_names[asset_arena.pages]);
+                }
+                asset_arena_is_initialized = true;
+        }
+
+        return &asset_arena.allocator;
+}
+
+extern bool grow_asset_allocation(void* ptr, size_t size)
+{
+        return asset_arena_is_initialized &&
+               vm_arena_grow(&asset_arena, ptr, size);
+}
+
+extern void reset_asset_allocator()
+{
+        if (asset_arena_is_initialized) {
+                vm_arena_reset(&asset_arena);
+        }
+}
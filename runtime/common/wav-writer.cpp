@@ -0,0 +1,152 @@
+/**
+ * \file
+ *
+ * Writes WAVE_FORMAT_IEEE_FLOAT files, in little endian order.
+ *
+ * The sizes inside the header are only known once the stream has been
+ * closed, so they get patched in at this point.
+ */
+
+#include <cstring> // memcpy
+
+#include "../wav_writer.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WAV_WRITER_HOST_IS_LITTLE_ENDIAN 0
+#else
+#define WAV_WRITER_HOST_IS_LITTLE_ENDIAN 1 // as are all windows targets
+#endif
+
+static int const wav_channel_count = 2;
+static int const wav_sample_rate = 48000;
+static int const wav_bytes_per_frame =
+        static_cast<int>(wav_channel_count * sizeof(float));
+static long const wav_riff_size_offset = 4;
+static long const wav_fact_frames_offset = 46;
+static long const wav_data_size_offset = 54;
+static long const wav_header_size = 58;
+
+static void write_u16(unsigned char* dest, uint32_t value)
+{
+        dest[0] = value & 0xff;
+        dest[1] = (value >> 8) & 0xff;
+}
+
+static void write_u32(unsigned char* dest, uint32_t value)
+{
+        write_u16(dest, value & 0xffff);
+        write_u16(dest + 2, value >> 16);
+}
+
+static int patch_u32(FILE* file, long offset, uint32_t value)
+{
+        unsigned char bytes[4];
+        write_u32(bytes, value);
+        if (fseek(file, offset, SEEK_SET)) {
+                return -1;
+        }
+        return fwrite(bytes, sizeof bytes, 1, file) == 1 ? 0 : -1;
+}
+
+/// writes the samples in little endian order, whatever the host's
+static int write_samples(FILE* file, float const samples[],
+                         size_t sample_count)
+{
+#if WAV_WRITER_HOST_IS_LITTLE_ENDIAN
+        return fwrite(samples, sizeof samples[0], sample_count, file) ==
+               sample_count ? 0 : -1;
+#else
+        unsigned char bytes[1024 * sizeof(uint32_t)];
+        size_t const chunk_count = sizeof bytes / sizeof(uint32_t);
+        for (size_t i = 0; i < sample_count; i += chunk_count) {
+                size_t const count = sample_count - i < chunk_count ?
+                                     sample_count - i : chunk_count;
+                for (size_t j = 0; j < count; j++) {
+                        uint32_t bits;
+                        memcpy(&bits, &samples[i + j], sizeof bits);
+                        write_u32(&bytes[j * sizeof bits], bits);
+                }
+                if (fwrite(bytes, sizeof(uint32_t), count, file) != count) {
+                        return -1;
+                }
+        }
+        return 0;
+#endif
+}
+
+extern int wav_writer_open(struct WavWriter* writer, char const* path)
+{
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+                return -1;
+        }
+
+        unsigned char header[wav_header_size];
+        memcpy(&header[0], "RIFF", 4);
+        write_u32(&header[4], 0);
+        memcpy(&header[8], "WAVE", 4);
+
+        memcpy(&header[12], "fmt ", 4);
+        write_u32(&header[16], 18);
+        write_u16(&header[20], 3); // WAVE_FORMAT_IEEE_FLOAT
+        write_u16(&header[22], wav_channel_count);
+        write_u32(&header[24], wav_sample_rate);
+        write_u32(&header[28], wav_sample_rate * wav_bytes_per_frame);
+        write_u16(&header[32], wav_bytes_per_frame);
+        write_u16(&header[34], 8 * wav_bytes_per_frame / wav_channel_count);
+        write_u16(&header[36], 0);
+
+        memcpy(&header[38], "fact", 4);
+        write_u32(&header[42], 4);
+        write_u32(&header[wav_fact_frames_offset], 0);
+
+        memcpy(&header[50], "data", 4);
+        write_u32(&header[wav_data_size_offset], 0);
+
+        if (fwrite(header, sizeof header, 1, file) != 1) {
+                fclose(file);
+                return -1;
+        }
+
+        writer->file = file;
+        writer->frame_count = 0;
+
+        return 0;
+}
+
+extern int wav_writer_write(struct WavWriter* writer,
+                            float const interleaved[],
+                            int frame_count)
+{
+        size_t const sample_count = wav_channel_count * frame_count;
+        if (write_samples(writer->file, interleaved, sample_count)) {
+                return -1;
+        }
+        writer->frame_count += frame_count;
+
+        return 0;
+}
+
+extern int wav_writer_close(struct WavWriter* writer)
+{
+        uint64_t const data_size = writer->frame_count * wav_bytes_per_frame;
+        int result = 0;
+        if (data_size + wav_header_size - 8 > UINT32_MAX) {
+                // too long for a RIFF file, leave the header sizes to zero
+                result = -1;
+        } else if (patch_u32(writer->file, wav_riff_size_offset,
+                             static_cast<uint32_t>(data_size + wav_header_size - 8))
+                   || patch_u32(writer->file, wav_fact_frames_offset,
+                                static_cast<uint32_t>(writer->frame_count))
+                   || patch_u32(writer->file, wav_data_size_offset,
+                                static_cast<uint32_t>(data_size))) {
+                result = -1;
+        }
+
+        if (fclose(writer->file)) {
+                result = -1;
+        }
+        writer->file = NULL;
+
+        return result;
+}
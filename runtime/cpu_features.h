@@ -0,0 +1,12 @@
+#pragma once
+
+/**
+ * instruction sets usable on the current cpu and operating system.
+ *
+ * always false on non-x86 architectures.
+ */
+extern bool cpu_has_sse2();
+extern bool cpu_has_avx2();
+
+/// whether the time stamp counter ticks at a constant rate, in all states
+extern bool cpu_has_invariant_tsc();
@@ -2,5 +2,24 @@
 #include "Darwin/play-audio.cpp"
 #include "Darwin/runtime.cpp"
 #include "common/allocator.cpp"
+#include "common/audio-render.cpp"
+#include "common/audio-ring.cpp"
+#include "common/audio-stats.cpp"
 #include "common/clock.cpp"
+#include "common/cpu-features.cpp"
+#include "common/dynamic-resolution.cpp"
+#include "common/frame-arena.cpp"
+#include "common/frame-capture.cpp"
+#include "common/frame-scheduler.cpp"
+#include "common/gl-profiler.cpp"
+#include "common/offline-render.cpp"
+#include "common/pixel-convert.cpp"
+#include "common/pool-allocator.cpp"
+#include "common/realtime-thread.cpp"
+#include "common/sample-convert.cpp"
+#include "common/tracking-allocator.cpp"
+#include "common/video-render.cpp"
+#include "common/virtual-clock.cpp"
+#include "common/vm-arena.cpp"
+#include "common/wav-writer.cpp"
 #include "open_window_with_glfw/open-window.cpp"
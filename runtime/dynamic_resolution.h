@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+struct DynamicResolution;
+
+/**
+ * Renders frames into an offscreen target whose resolution follows the
+ * gpu time of frames, to hold a frame time budget on machines that
+ * cannot afford the native resolution. The target is then upscaled to
+ * the window with bilinear filtering.
+ *
+ * The target is as large as the window, and frames are rendered into
+ * its lower left corner: changing the resolution costs nothing, and
+ * the target is only reallocated when the window is resized.
+ *
+ * The resolution drops as soon as the smoothed gpu time exceeds the
+ * budget, and only rises again once it is well below it, after the
+ * frames rendered at the previous resolution have been measured.
+ *
+ * MICROS_DYNAMIC_RESOLUTION=1 enables it, MICROS_GPU_BUDGET_MS=<ms>
+ * sets the budget (by default 90% of the frame period) and
+ * MICROS_DYNAMIC_RESOLUTION_MIN=<scale> the lowest scale, 0.5 by
+ * default. It stays off without timer queries, which measure gpu time.
+ *
+ * To be used by the thread owning the OpenGL context.
+ */
+
+/**
+ * @param frame_period_micros time between frames, for the default budget
+ * @return NULL unless MICROS_DYNAMIC_RESOLUTION=1 asks for it
+ */
+extern struct DynamicResolution* dynamic_resolution_create(
+        uint64_t frame_period_micros);
+/// prints a summary, then releases the target
+extern void dynamic_resolution_destroy(struct DynamicResolution* resolution);
+
+/// gpu time of a completed frame, to adapt the resolution. 0 if unknown
+extern void dynamic_resolution_measure(struct DynamicResolution* resolution,
+                                       uint64_t gpu_nanos);
+
+/**
+ * binds the target before rendering a frame for a window of the given
+ * size, and sets the viewport.
+ *
+ * For a NULL resolution, the frame is rendered at the window's size
+ * into the bound framebuffer.
+ *
+ * @param render_widthp, render_heightp size to render the frame at
+ */
+extern void dynamic_resolution_begin_frame(struct DynamicResolution* resolution,
+                uint32_t window_width,
+                uint32_t window_height,
+                uint32_t* render_widthp,
+                uint32_t* render_heightp);
+
+/**
+ * upscales the frame into the default framebuffer. Blending, culling,
+ * depth, scissor, stencil and sRGB writes are left disabled, and the
+ * program, vertex array and texture bindings at 0.
+ */
+extern void dynamic_resolution_end_frame(struct DynamicResolution* resolution);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "allocator_type.h"
+
+/**
+ * Linear allocator for memory which only lives until the end of a
+ * frame: allocations bump a pointer inside a fixed block, freeing does
+ * nothing, and resetting the arena makes the whole block available
+ * again.
+ *
+ * When the block is exhausted, allocations fail rather than falling
+ * back on the heap.
+ */
+struct FrameArena {
+        struct Allocator allocator; // first, to be usable as an Allocator
+        struct Allocator* parent;
+        char* memory;
+        size_t capacity;
+        size_t used;
+        bool has_overflowed;
+};
+
+extern int frame_arena_init(struct FrameArena* arena,
+                            struct Allocator* parent,
+                            size_t capacity);
+extern void frame_arena_deinit(struct FrameArena* arena);
+extern void frame_arena_reset(struct FrameArena* arena);
+
+/**
+ * resets the arena returned by frame_allocator() on the calling thread,
+ * if it has one. Called by the runtime after each video frame and each
+ * audio render.
+ */
+extern void frame_arena_reset_thread();
+
+/**
+ * gives the calling thread its arena now, rather than on its first
+ * frame_allocator() call. Audio threads call it before rendering, so
+ * that no render pays for the allocation of the arena.
+ */
+extern void frame_arena_prepare_thread();
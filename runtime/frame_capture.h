@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+struct Clock;
+struct FrameCapture;
+
+/**
+ * Captures rendered frames to a file, without stalling the gpu.
+ *
+ * Frames are read back into a ring of pixel buffer objects, which are
+ * mapped once their transfer has completed, usually on the next frame,
+ * and handed to a writer thread. The render thread never waits for the
+ * gpu or the disk: when the writer falls behind, frames are dropped,
+ * unless the capture is offline, in which case it waits. Frames of
+ * another size, after a window resize, are scaled to the size of the
+ * capture. The first failed write stops the capture.
+ *
+ * Files ending in .y4m receive YUV 4:2:0 frames in the YUV4MPEG2
+ * format that video encoders read. The conversion is shared between
+ * a pool of worker threads, by bands of rows.
+ * (MICROS_CAPTURE_THREADS=<count> sets the size of the pool, by default
+ * all cores but two.)
+ * Other files receive raw 8bit RGBA pixels, top row first.
+ *
+ * To be used by the thread owning the OpenGL context.
+ */
+
+/**
+ * @param path file to write to, no capture when NULL or empty
+ * @param clock to measure each stage
+ * @param frames_per_second recorded in the .y4m header
+ * @param is_offline whether to wait rather than drop frames
+ * @return NULL when not capturing
+ */
+extern struct FrameCapture* frame_capture_create(char const* path,
+                struct Clock* clock,
+                uint32_t width,
+                uint32_t height,
+                uint32_t frames_per_second,
+                bool is_offline);
+/// writes the remaining frames, then releases the capture
+extern void frame_capture_destroy(struct FrameCapture* capture);
+
+/**
+ * captures the frame rendered into framebuffer, once rendering is
+ * done. Does nothing for a NULL capture.
+ */
+extern void frame_capture_read(struct FrameCapture* capture,
+                               unsigned int framebuffer,
+                               uint32_t width,
+                               uint32_t height);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+struct Clock;
+
+/**
+ * Schedules video frames against the display's refresh.
+ *
+ * A frame shows up on screen at a vblank after its swap, rather than
+ * when it started rendering. The scheduler estimates the refresh period
+ * from the times at which swaps return, and predicts when the frame
+ * being rendered will be presented, so animations are evaluated for
+ * the moment they are seen.
+ *
+ * When a frame cannot be ready for the next vblank, given how long
+ * frames take to render, its presentation is predicted at a later
+ * vblank: time skips ahead instead of the animation lagging behind.
+ *
+ * MICROS_SWAP_INTERVAL=<vblanks> sets the number of vblanks per frame,
+ * 1 by default. 0 disables vsync, frames are then presented as soon as
+ * they are rendered.
+ */
+struct FrameScheduler {
+        struct Clock* clock;
+        int swap_interval;
+        double period_micros; // estimated refresh period
+        double render_micros; // estimated duration of a frame, up to its swap
+        uint64_t frame_start_micros;
+        uint64_t present_micros; // predicted for the current frame
+        uint64_t last_swap_micros; // 0 before the first swap
+        int skipped_vblanks; // by the current frame
+
+        // pacing statistics
+        uint64_t frame_count;
+        uint64_t missed_vblank_count; // frames presented later than predicted
+        uint64_t skipped_vblank_count;
+        uint64_t max_interval_micros;
+        double interval_sum;
+        double interval_square_sum;
+        double prediction_error_sum;
+};
+
+/// @param refresh_hz nominal refresh rate of the display, 0 if unknown
+extern void frame_scheduler_init(struct FrameScheduler* scheduler,
+                                 struct Clock* clock,
+                                 int refresh_hz);
+
+/// @return the predicted presentation time of the frame, in clock time
+extern uint64_t frame_scheduler_begin_frame(struct FrameScheduler* scheduler);
+
+/// to call just before and just after swapping buffers
+extern void frame_scheduler_will_swap(struct FrameScheduler* scheduler);
+extern void frame_scheduler_did_swap(struct FrameScheduler* scheduler);
+
+/// prints frame pacing statistics
+extern void frame_scheduler_print_summary(
+        struct FrameScheduler const* scheduler);
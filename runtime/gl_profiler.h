@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+struct Clock;
+struct GlProfiler;
+
+/**
+ * Measures the gpu and cpu time of video frames, and of the scopes
+ * opened with micros/profile.h, without ever stalling on the gpu.
+ *
+ * Frames and their scopes are wrapped in pairs of timestamp queries,
+ * which can nest. Their results are read back from a ring of query
+ * objects, as many frames later as the window may have in flight (8).
+ * Without timer queries only cpu times are measured.
+ *
+ * To be used by the thread owning the OpenGL context.
+ */
+
+/// @return NULL unless MICROS_PROFILE=1 asks for profiling
+extern struct GlProfiler* gl_profiler_create(struct Clock* clock);
+/// prints the summary, then releases the profiler
+extern void gl_profiler_destroy(struct GlProfiler* profiler);
+
+/// around the call to render_next_gl3, doing nothing for a NULL profiler
+extern void gl_profiler_begin_frame(struct GlProfiler* profiler);
+extern void gl_profiler_end_frame(struct GlProfiler* profiler);
+
+extern void gl_profiler_print_summary(struct GlProfiler* profiler);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+struct Clock;
+
+/**
+ * Runs the offline render mode when it has been requested by the
+ * environment:
+ *
+ * MICROS_RENDER_AUDIO=<path.wav> renders the soundtrack into a WAV file
+ * as fast as possible, for MICROS_RENDER_SECONDS (default: 60)
+ *
+ * @return true if the offline mode ran, in which case the runtime
+ * should not open any stream or window.
+ */
+extern bool run_offline_render(struct Clock* clock);
+
+/**
+ * renders duration_micros of the soundtrack into a WAV file, starting
+ * at time zero.
+ *
+ * @return false on failure
+ */
+extern bool offline_render_audio(char const* wav_path,
+                                 uint64_t duration_micros,
+                                 struct Clock* clock);
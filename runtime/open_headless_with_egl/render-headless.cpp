@@ -0,0 +1,295 @@
+/**
+ * \file
+ *
+ * Render video frames without any display, using an EGL surfaceless
+ * context (Mesa's llvmpipe for instance on machines without a GPU)
+ *
+ * Frames are rendered into a framebuffer object as fast as possible,
+ * with deterministic time derived from the frame index.
+ *
+ * MICROS_HEADLESS=<width>x<height> enables this mode
+ * MICROS_HEADLESS_FPS sets the frame rate (default: 60)
+ * MICROS_RENDER_SECONDS sets the duration (default: 60)
+ *
+ * MICROS_EXPORT=<basename> exports the demo as <basename>.y4m and
+ * <basename>.wav, rendering the soundtrack on its own thread while the
+ * frames are converted by the capture's workers. The size defaults to
+ * 1920x1080 in this mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <exception>
+#include <thread>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+
+#include <micros/api.h>
+
+#include "../clock.h"
+#include "../frame_arena.h"
+#include "../frame_capture.h"
+#include "../gl_profiler.h"
+#include "../offline_render.h"
+#include "../video_render.h"
+
+struct HeadlessContext {
+        EGLDisplay display;
+        EGLContext context;
+};
+
+static bool headless_context_create(struct HeadlessContext* headless)
+{
+        EGLDisplay display = EGL_NO_DISPLAY;
+
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+                reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>
+                (eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (get_platform_display) {
+                display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                               EGL_DEFAULT_DISPLAY, NULL);
+        }
+        if (EGL_NO_DISPLAY == display) {
+                display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+
+        EGLint major, minor;
+        if (EGL_NO_DISPLAY == display
+            || !eglInitialize(display, &major, &minor)) {
+                fprintf(stderr, "egl: could not initialize\n");
+                return false;
+        }
+
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+                fprintf(stderr, "egl: OpenGL not supported\n");
+                return false;
+        }
+
+        EGLint const config_attributes[] = {
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                // no window or pbuffer surface will be created
+                EGL_SURFACE_TYPE, 0,
+                EGL_NONE,
+        };
+        EGLConfig config;
+        EGLint config_count;
+        if (!eglChooseConfig(display, config_attributes, &config, 1,
+                             &config_count) || config_count < 1) {
+                fprintf(stderr, "egl: no config for OpenGL\n");
+                return false;
+        }
+
+        auto glMajorVersion = 3;
+        auto glMinorVersion = 2;
+
+        EGLint const context_attributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, glMajorVersion,
+                EGL_CONTEXT_MINOR_VERSION, glMinorVersion,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE,
+        };
+        EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+                                              context_attributes);
+        if (EGL_NO_CONTEXT == context) {
+                fprintf(stderr, "could not create context for OpenGL >=%d.%d\n",
+                        glMajorVersion, glMinorVersion);
+                return false;
+        }
+
+        if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+                fprintf(stderr, "egl: surfaceless contexts not supported\n");
+                return false;
+        }
+
+        headless->display = display;
+        headless->context = context;
+        fprintf(stdout, "Status: Using EGL %d.%d\n", major, minor);
+
+        return true;
+}
+
+static void headless_context_destroy(struct HeadlessContext* headless)
+{
+        eglMakeCurrent(headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+        eglDestroyContext(headless->display, headless->context);
+        eglTerminate(headless->display);
+}
+
+static void render_headless(struct Clock* clock,
+                            char const* capture_path,
+                            uint32_t width,
+                            uint32_t height,
+                            uint32_t frames_per_second,
+                            uint64_t frame_total)
+{
+        struct HeadlessContext headless;
+        if (!headless_context_create(&headless)) {
+                return;
+        }
+
+        glewExperimental = GL_TRUE;
+        GLenum err = glewInit();
+        if (GLEW_OK != err) {
+                fprintf(stderr, "glew error: %s\n", glewGetErrorString(err));
+                headless_context_destroy(&headless);
+                return;
+        }
+        fprintf(stdout, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
+
+        GLuint renderbuffers[2];
+        glGenRenderbuffers(2, renderbuffers);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  GL_RENDERBUFFER, renderbuffers[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                                  GL_RENDERBUFFER, renderbuffers[1]);
+
+        if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER)) {
+                fprintf(stderr, "could not create %ux%u framebuffer\n", width, height);
+        } else {
+                struct GlProfiler* profiler = gl_profiler_create(clock);
+                struct FrameCapture* capture =
+                        frame_capture_create(capture_path, clock, width, height,
+                                             frames_per_second, true);
+                struct VideoRender video;
+                video_render_init(&video);
+                uint64_t const start_micros = clock_microseconds(clock);
+                uint64_t frame_index;
+                for (frame_index = 0; frame_index < frame_total; frame_index++) {
+                        glViewport(0, 0, width, height);
+
+                        // nothing is presented: the frame's period is
+                        // its budget
+                        struct FrameInfo frame_info;
+                        frame_info.display = { width, height };
+                        frame_info.time_micros =
+                                1000000 * frame_index / frames_per_second;
+                        frame_info.refresh_period_micros =
+                                1000000 / frames_per_second;
+                        frame_info.begin_micros = clock_microseconds(clock);
+                        frame_info.present_micros =
+                                frame_info.begin_micros +
+                                frame_info.refresh_period_micros;
+                        frame_info.content_scale_x = 1.0f;
+                        frame_info.content_scale_y = 1.0f;
+                        frame_info.pixel_aspect_ratio = 1.0f;
+
+                        gl_profiler_begin_frame(profiler);
+                        try {
+                                video_render_frame(&video, &frame_info);
+                        } catch (std::exception& e) {
+                                fprintf(stderr, "caught exception: '%s', exiting.\n", e.what());
+                                gl_profiler_end_frame(profiler);
+                                break;
+                        }
+                        gl_profiler_end_frame(profiler);
+                        frame_capture_read(capture, framebuffer, width, height);
+                        frame_arena_reset_thread();
+                }
+                glFinish();
+                uint64_t const elapsed_micros = clock_microseconds(clock) - start_micros;
+
+                double const elapsed_seconds = elapsed_micros / 1e6;
+                printf("rendered %llu frames of %ux%u in %.3fs (%.1f frames per second)\n",
+                       static_cast<unsigned long long>(frame_index), width, height,
+                       elapsed_seconds,
+                       elapsed_seconds > 0.0 ? frame_index / elapsed_seconds : 0.0);
+                gl_profiler_destroy(profiler);
+                frame_capture_destroy(capture);
+        }
+
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(2, renderbuffers);
+        headless_context_destroy(&headless);
+}
+
+struct HeadlessExportAudio {
+        char path[1024];
+        struct Clock* clock;
+        uint64_t duration_micros;
+        uint64_t end_micros;
+};
+
+static void headless_export_audio(struct HeadlessExportAudio* audio)
+{
+        offline_render_audio(audio->path, audio->duration_micros, audio->clock);
+        audio->end_micros = clock_microseconds(audio->clock);
+}
+
+extern bool run_headless_render(struct Clock* clock)
+{
+        char const* export_basename = getenv("MICROS_EXPORT");
+        if (export_basename && !export_basename[0]) {
+                export_basename = NULL;
+        }
+
+        char const* size = getenv("MICROS_HEADLESS");
+        if (!size && export_basename) {
+                size = "1920x1080";
+        }
+        if (!size) {
+                return false;
+        }
+
+        unsigned int width, height;
+        if (2 != sscanf(size, "%ux%u", &width, &height) || !width || !height) {
+                fprintf(stderr, "expected MICROS_HEADLESS=<width>x<height>, got %s\n",
+                        size);
+                return true;
+        }
+
+        char const* fps = getenv("MICROS_HEADLESS_FPS");
+        uint32_t const frames_per_second = fps && atoi(fps) > 0 ? atoi(fps) : 60;
+
+        char const* seconds = getenv("MICROS_RENDER_SECONDS");
+        double const duration_seconds = seconds ? atof(seconds) : 60.0;
+        uint64_t const frame_total = duration_seconds > 0.0 ?
+                                     static_cast<uint64_t>(duration_seconds * frames_per_second) : 0;
+
+        if (!export_basename) {
+                render_headless(clock, getenv("MICROS_CAPTURE"), width, height,
+                                frames_per_second, frame_total);
+                return true;
+        }
+
+        char video_path[1024];
+        snprintf(video_path, sizeof video_path, "%s.y4m", export_basename);
+        struct HeadlessExportAudio audio;
+        snprintf(audio.path, sizeof audio.path, "%s.wav", export_basename);
+        audio.clock = clock;
+        audio.duration_micros = 1000000 * frame_total / frames_per_second;
+        uint64_t const duration_micros = audio.duration_micros;
+
+        // the soundtrack is independent from the frames, and takes a core
+        // of its own
+        uint64_t const start_micros = clock_microseconds(clock);
+        audio.end_micros = start_micros;
+        std::thread audio_thread(headless_export_audio, &audio);
+        render_headless(clock, video_path, width, height, frames_per_second,
+                        frame_total);
+        uint64_t const video_end_micros = clock_microseconds(clock);
+        audio_thread.join();
+        uint64_t const end_micros = clock_microseconds(clock);
+
+        double const elapsed_seconds = (end_micros - start_micros) / 1e6;
+        printf("export: %.3fs of audio and video in %.3fs (%.1fx realtime), "
+               "audio done after %.3fs, video after %.3fs\n",
+               duration_micros / 1e6, elapsed_seconds,
+               elapsed_seconds > 0.0 ? duration_micros / 1e6 / elapsed_seconds :
+               0.0,
+               (audio.end_micros - start_micros) / 1e6,
+               (video_end_micros - start_micros) / 1e6);
+
+        return true;
+}
@@ -1,18 +1,325 @@
+/**
+ * \file
+ *
+ * Window for the video entry point.
+ *
+ * The main thread runs the glfw event loop, while a render thread owns
+ * the OpenGL context and calls render_next_gl3. Window state and key
+ * presses reach the render thread through a lock-free mailbox, so that
+ * event processing (like a live resize) never delays a frame.
+ *
+ * A fence ends each frame, which bounds how many frames the render
+ * thread submits ahead of the gpu: MICROS_FRAMES_IN_FLIGHT=<frames>
+ * sets that bound, 2 by default. More frames in flight absorb uneven
+ * frames better, fewer give a lower latency.
+ *
+ * With MICROS_DYNAMIC_RESOLUTION=1, frames are rendered offscreen at a
+ * resolution adapted to their gpu time, see dynamic_resolution.h
+ *
+ * The event loop polls every 2ms rather than waiting for events: the
+ * glfw 3.0 headers in libs/, which every build compiles against, have
+ * no empty event for the render thread to wake it when it stops.
+ */
+
 #include <math.h> // sqrt
 #include <stdio.h> // snprintf
+#include <stdlib.h> // getenv
+#include <atomic>
+#include <chrono>
 #include <exception>
+#include <thread>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include <micros/api.h>
 
+#include "../clock.h"
+#include "../dynamic_resolution.h"
+#include "../frame_arena.h"
+#include "../frame_capture.h"
+#include "../frame_scheduler.h"
+#include "../gl_profiler.h"
+#include "../video_render.h"
+#include "../virtual_clock.h"
+
+enum {
+        WINDOW_MAILBOX_KEY_COUNT = 32,
+        // the gl profiler keeps as many frames of queries
+        FRAME_PIPELINE_MAX_DEPTH = 8,
+};
+
+/// posted by the event loop for the render thread, and back
+struct WindowMailbox {
+        std::atomic<uint64_t> framebuffer_wh; // width << 32 | height
+        std::atomic<uint64_t> window_wh; // in screen coordinates
+        std::atomic<bool> must_close;
+        std::atomic<bool> has_stopped; // by the render thread
+
+        // key presses, from the event loop to the render thread
+        int keys[WINDOW_MAILBOX_KEY_COUNT];
+        std::atomic<uint32_t> key_write_count;
+        std::atomic<uint32_t> key_read_count;
+};
+
+struct RenderThread {
+        GLFWwindow* window;
+        struct Clock* clock;
+        struct VirtualClock* virtual_clock;
+        int refresh_hz;
+        float pixel_aspect_ratio; // of the monitor's pixels
+        struct WindowMailbox mailbox;
+        std::thread thread;
+};
+
+/// fences of the frames in flight, and how long they made us wait
+struct FramePipeline {
+        struct Clock* clock;
+        int depth;
+        uint64_t frame_count;
+        GLsync fences[FRAME_PIPELINE_MAX_DEPTH];
+        // gpu timestamps of the start and end of each frame
+        GLuint queries[2 * FRAME_PIPELINE_MAX_DEPTH];
+        bool has_timer_query;
+
+        // statistics
+        uint64_t wait_micros_sum;
+        uint64_t max_wait_micros;
+        uint64_t gpu_frame_count;
+        uint64_t gpu_nanos_sum;
+        uint64_t max_gpu_nanos;
+};
+
+static void frame_pipeline_init(struct FramePipeline* pipeline,
+                                struct Clock* clock)
+{
+        char const* frames = getenv("MICROS_FRAMES_IN_FLIGHT");
+        int depth = frames && frames[0] ? atoi(frames) : 2;
+        depth = depth < 1 ? 1 : depth > FRAME_PIPELINE_MAX_DEPTH ?
+                FRAME_PIPELINE_MAX_DEPTH : depth;
+
+        pipeline->clock = clock;
+        pipeline->depth = depth;
+        pipeline->frame_count = 0;
+        pipeline->has_timer_query = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+        for (int i = 0; i < FRAME_PIPELINE_MAX_DEPTH; i++) {
+                pipeline->fences[i] = NULL;
+        }
+        if (pipeline->has_timer_query) {
+                glGenQueries(2 * depth, pipeline->queries);
+        }
+
+        pipeline->wait_micros_sum = 0;
+        pipeline->max_wait_micros = 0;
+        pipeline->gpu_frame_count = 0;
+        pipeline->gpu_nanos_sum = 0;
+        pipeline->max_gpu_nanos = 0;
+
+        printf("video: up to %d frames in flight%s\n", depth,
+               pipeline->has_timer_query ? ", measuring gpu time" : "");
+}
+
+static void frame_pipeline_deinit(struct FramePipeline* pipeline)
+{
+        for (int i = 0; i < pipeline->depth; i++) {
+                if (pipeline->fences[i]) {
+                        glDeleteSync(pipeline->fences[i]);
+                }
+        }
+        if (pipeline->has_timer_query) {
+                glDeleteQueries(2 * pipeline->depth, pipeline->queries);
+        }
+
+        uint64_t const frame_count = pipeline->frame_count;
+        if (0 == frame_count) {
+                return;
+        }
+        printf("  %d frames in flight, cpu waited %.2fms per frame "
+               "(max %.2fms)",
+               pipeline->depth,
+               pipeline->wait_micros_sum / 1000.0 / frame_count,
+               pipeline->max_wait_micros / 1000.0);
+        if (pipeline->gpu_frame_count) {
+                printf(", gpu busy %.2fms per frame (max %.2fms)",
+                       pipeline->gpu_nanos_sum / 1e6 / pipeline->gpu_frame_count,
+                       pipeline->max_gpu_nanos / 1e6);
+        }
+        printf("\n");
+}
+
+/**
+ * waits until the frame which used this slot has completed
+ *
+ * @return the gpu time of that frame, 0 when unknown
+ */
+static uint64_t frame_pipeline_begin_frame(struct FramePipeline* pipeline)
+{
+        int const slot = pipeline->frame_count % pipeline->depth;
+        GLsync const fence = pipeline->fences[slot];
+        uint64_t gpu_nanos = 0;
+        if (fence) {
+                uint64_t const start_micros =
+                        clock_microseconds(pipeline->clock);
+                GLenum result;
+                do {
+                        result = glClientWaitSync(fence,
+                                                  GL_SYNC_FLUSH_COMMANDS_BIT,
+                                                  1000000000);
+                } while (GL_TIMEOUT_EXPIRED == result);
+                uint64_t const wait_micros =
+                        clock_microseconds(pipeline->clock) - start_micros;
+
+                glDeleteSync(fence);
+                pipeline->fences[slot] = NULL;
+                pipeline->wait_micros_sum += wait_micros;
+                if (wait_micros > pipeline->max_wait_micros) {
+                        pipeline->max_wait_micros = wait_micros;
+                }
+
+                if (pipeline->has_timer_query) {
+                        // available since its frame completed
+                        GLuint64 start_nanos, end_nanos;
+                        glGetQueryObjectui64v(pipeline->queries[2 * slot],
+                                              GL_QUERY_RESULT, &start_nanos);
+                        glGetQueryObjectui64v(pipeline->queries[2 * slot + 1],
+                                              GL_QUERY_RESULT, &end_nanos);
+                        gpu_nanos = end_nanos - start_nanos;
+                        pipeline->gpu_frame_count++;
+                        pipeline->gpu_nanos_sum += gpu_nanos;
+                        if (gpu_nanos > pipeline->max_gpu_nanos) {
+                                pipeline->max_gpu_nanos = gpu_nanos;
+                        }
+                }
+        }
+
+        // timestamps rather than a GL_TIME_ELAPSED query, which would
+        // not nest with the profiler's
+        if (pipeline->has_timer_query) {
+                glQueryCounter(pipeline->queries[2 * slot], GL_TIMESTAMP);
+        }
+        return gpu_nanos;
+}
+
+/// after the frame's swap
+static void frame_pipeline_end_frame(struct FramePipeline* pipeline)
+{
+        int const slot = pipeline->frame_count % pipeline->depth;
+        if (pipeline->has_timer_query) {
+                glQueryCounter(pipeline->queries[2 * slot + 1], GL_TIMESTAMP);
+        }
+        pipeline->fences[slot] =
+                glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        pipeline->frame_count++;
+}
+
+static uint64_t mailbox_pack_size(int width, int height)
+{
+        return static_cast<uint64_t>(width) << 32 |
+               static_cast<uint32_t>(height);
+}
+
+static void mailbox_post_framebuffer_size(struct WindowMailbox* mailbox,
+                GLFWwindow* window,
+                int width, int height)
+{
+        int window_width, window_height;
+        glfwGetWindowSize(window, &window_width, &window_height);
+        uint64_t const window_wh =
+                mailbox_pack_size(window_width, window_height);
+        mailbox->window_wh.store(window_wh, std::memory_order_release);
+        mailbox->framebuffer_wh.store(mailbox_pack_size(width, height),
+                                      std::memory_order_release);
+}
+
+/// drops the key when the render thread is that far behind
+static void mailbox_post_key(struct WindowMailbox* mailbox, int key)
+{
+        uint32_t const write_count =
+                mailbox->key_write_count.load(std::memory_order_relaxed);
+        uint32_t const read_count =
+                mailbox->key_read_count.load(std::memory_order_acquire);
+        if (write_count - read_count == WINDOW_MAILBOX_KEY_COUNT) {
+                return;
+        }
+
+        mailbox->keys[write_count % WINDOW_MAILBOX_KEY_COUNT] = key;
+        mailbox->key_write_count.store(write_count + 1,
+                                       std::memory_order_release);
+}
+
+/// @return false when no key was posted
+static bool mailbox_take_key(struct WindowMailbox* mailbox, int* key)
+{
+        uint32_t const read_count =
+                mailbox->key_read_count.load(std::memory_order_relaxed);
+        if (read_count ==
+            mailbox->key_write_count.load(std::memory_order_acquire)) {
+                return false;
+        }
+
+        *key = mailbox->keys[read_count % WINDOW_MAILBOX_KEY_COUNT];
+        mailbox->key_read_count.store(read_count + 1,
+                                      std::memory_order_release);
+        return true;
+}
+
+/// space pauses, arrows seek and change the rate, home restarts
+static void control_virtual_clock(struct VirtualClock* virtual_clock,
+                                  int key)
+{
+        uint64_t const seek_micros = 5000000;
+        uint64_t const now = virtual_clock_micros(virtual_clock);
+
+        switch (key) {
+        case GLFW_KEY_SPACE:
+                virtual_clock_toggle_pause(virtual_clock);
+                break;
+        case GLFW_KEY_LEFT:
+                virtual_clock_seek(virtual_clock,
+                                   now > seek_micros ? now - seek_micros : 0);
+                break;
+        case GLFW_KEY_RIGHT:
+                virtual_clock_seek(virtual_clock, now + seek_micros);
+                break;
+        case GLFW_KEY_HOME:
+                virtual_clock_seek(virtual_clock, 0);
+                break;
+        case GLFW_KEY_UP:
+                virtual_clock_set_rate(virtual_clock,
+                                       2.0 * virtual_clock_rate(virtual_clock));
+                break;
+        case GLFW_KEY_DOWN:
+                virtual_clock_set_rate(virtual_clock,
+                                       0.5 * virtual_clock_rate(virtual_clock));
+                break;
+        default:
+                return;
+        }
+
+        printf("virtual clock: %.3fs, rate %.3f\n",
+               virtual_clock_micros(virtual_clock) / 1e6,
+               virtual_clock_rate(virtual_clock));
+}
+
 static void do_keyboard (GLFWwindow* window, int key, int scancode,
                          int action, int mods)
 {
         if (GLFW_KEY_ESCAPE == key) {
                 glfwSetWindowShouldClose(window, GL_TRUE);
         }
+
+        struct RenderThread* render =
+                static_cast<struct RenderThread*>(glfwGetWindowUserPointer(window));
+        if (render->virtual_clock && GLFW_PRESS == action) {
+                mailbox_post_key(&render->mailbox, key);
+        }
+}
+
+static void do_framebuffer_size (GLFWwindow* window, int width, int height)
+{
+        struct RenderThread* render =
+                static_cast<struct RenderThread*>(glfwGetWindowUserPointer(window));
+        mailbox_post_framebuffer_size(&render->mailbox, window, width, height);
 }
 
 static void do_mouse_button (GLFWwindow* window, int button, int action,
@@ -24,7 +331,126 @@ static void do_mouse_button (GLFWwindow* window, int button, int action,
 
 }
 
-void open_window(char const * title, bool const prefers_fullscreen)
+static void render_loop(struct RenderThread* render)
+{
+        GLFWwindow* window = render->window;
+        struct WindowMailbox* mailbox = &render->mailbox;
+        struct VirtualClock* virtual_clock = render->virtual_clock;
+
+        glfwMakeContextCurrent(window);
+        glewExperimental = GL_TRUE;
+        GLenum err = glewInit();
+        if (GLEW_OK != err) {
+                /* Problem: glewInit failed, something is seriously wrong. */
+                fprintf(stderr, "glew error: %s\n", glewGetErrorString(err));
+                mailbox->has_stopped.store(true);
+                return;
+        }
+        fprintf(stdout, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
+
+        struct FrameScheduler scheduler;
+        frame_scheduler_init(&scheduler, render->clock, render->refresh_hz);
+        glfwSwapInterval(scheduler.swap_interval);
+
+        struct FramePipeline pipeline;
+        frame_pipeline_init(&pipeline, render->clock);
+        struct GlProfiler* profiler = gl_profiler_create(render->clock);
+        struct DynamicResolution* resolution = dynamic_resolution_create(
+                        static_cast<uint64_t>(scheduler.period_micros *
+                                              (scheduler.swap_interval > 1 ?
+                                               scheduler.swap_interval : 1)));
+        struct VideoRender video;
+        video_render_init(&video);
+        struct FrameCapture* capture = NULL;
+        {
+                uint64_t const wh =
+                        mailbox->framebuffer_wh.load(std::memory_order_acquire);
+                capture = frame_capture_create(getenv("MICROS_CAPTURE"),
+                                               render->clock,
+                                               static_cast<uint32_t>(wh >> 32),
+                                               static_cast<uint32_t>(wh),
+                                               render->refresh_hz, false);
+        }
+
+        while (!mailbox->must_close.load()) {
+                int key;
+                while (mailbox_take_key(mailbox, &key)) {
+                        control_virtual_clock(virtual_clock, key);
+                }
+
+                uint64_t const wh =
+                        mailbox->framebuffer_wh.load(std::memory_order_acquire);
+                uint32_t const width = static_cast<uint32_t>(wh >> 32);
+                uint32_t const height = static_cast<uint32_t>(wh);
+                uint64_t const window_wh =
+                        mailbox->window_wh.load(std::memory_order_acquire);
+                uint32_t const window_width =
+                        static_cast<uint32_t>(window_wh >> 32);
+                uint32_t const window_height = static_cast<uint32_t>(window_wh);
+
+                uint64_t const gpu_nanos = frame_pipeline_begin_frame(&pipeline);
+                dynamic_resolution_measure(resolution, gpu_nanos);
+                uint32_t render_width, render_height;
+                dynamic_resolution_begin_frame(resolution, width, height,
+                                               &render_width, &render_height);
+                uint64_t const present_micros =
+                        frame_scheduler_begin_frame(&scheduler);
+                uint64_t const frame_micros = virtual_clock ?
+                                              virtual_clock_next_frame(virtual_clock,
+                                                              present_micros) :
+                                              present_micros;
+
+                struct FrameInfo frame_info;
+                frame_info.display = { render_width, render_height };
+                frame_info.time_micros = frame_micros;
+                frame_info.refresh_period_micros =
+                        static_cast<uint64_t>(scheduler.period_micros + 0.5);
+                frame_info.begin_micros = scheduler.frame_start_micros;
+                frame_info.present_micros = present_micros;
+                frame_info.content_scale_x = window_width ?
+                                             static_cast<float>(render_width) /
+                                             window_width : 1.0f;
+                frame_info.content_scale_y = window_height ?
+                                             static_cast<float>(render_height) /
+                                             window_height : 1.0f;
+                // rendered pixels are stretched over the framebuffer's
+                frame_info.pixel_aspect_ratio = render->pixel_aspect_ratio;
+                if (height && render_width) {
+                        frame_info.pixel_aspect_ratio *=
+                                (static_cast<float>(width) * render_height) /
+                                (static_cast<float>(height) * render_width);
+                }
+
+                gl_profiler_begin_frame(profiler);
+                try {
+                        video_render_frame(&video, &frame_info);
+                } catch (std::exception& e) {
+                        fprintf(stderr, "caught exception: '%s', exiting.\n", e.what());
+                        gl_profiler_end_frame(profiler);
+                        break;
+                }
+                gl_profiler_end_frame(profiler);
+                dynamic_resolution_end_frame(resolution);
+                frame_capture_read(capture, 0, width, height);
+                frame_arena_reset_thread();
+                frame_scheduler_will_swap(&scheduler);
+                glfwSwapBuffers(window);
+                frame_scheduler_did_swap(&scheduler);
+                frame_pipeline_end_frame(&pipeline);
+        }
+
+        frame_scheduler_print_summary(&scheduler);
+        frame_pipeline_deinit(&pipeline);
+        gl_profiler_destroy(profiler);
+        dynamic_resolution_destroy(resolution);
+        frame_capture_destroy(capture);
+        glfwMakeContextCurrent(NULL);
+        mailbox->has_stopped.store(true);
+}
+
+void open_window(char const * title, bool const prefers_fullscreen,
+                 struct Clock* clock,
+                 struct VirtualClock* virtual_clock)
 {
         if (!glfwInit()) {
                 printf("glfw: could not initialize\n");
@@ -68,37 +494,56 @@ void open_window(char const * title, bool const prefers_fullscreen)
                 return;
         }
 
-        glfwSetKeyCallback(window, do_keyboard);
-        glfwSetMouseButtonCallback(window, do_mouse_button);
-
-        glfwMakeContextCurrent(window);
-        glewExperimental = GL_TRUE;
-        GLenum err = glewInit();
-        if (GLEW_OK != err) {
-                /* Problem: glewInit failed, something is seriously wrong. */
-                fprintf(stderr, "glew error: %s\n", glewGetErrorString(err));
-                return;
+        struct RenderThread* render = new RenderThread;
+        render->window = window;
+        render->clock = clock;
+        render->virtual_clock = virtual_clock;
+        render->refresh_hz = mode->refreshRate;
+        render->pixel_aspect_ratio = 1.0f;
+        {
+                // from the physical size, when it is plausible. Sizes are
+                // in whole millimeters, so close ratios are taken as square
+                int width_mm, height_mm;
+                glfwGetMonitorPhysicalSize(monitor, &width_mm, &height_mm);
+                if (width_mm > 0 && height_mm > 0) {
+                        float const ratio =
+                                (static_cast<float>(width_mm) * mode->height) /
+                                (static_cast<float>(height_mm) * mode->width);
+                        if (ratio > 0.5f && ratio < 2.0f &&
+                            (ratio < 0.98f || ratio > 1.02f)) {
+                                render->pixel_aspect_ratio = ratio;
+                        }
+                }
         }
-        fprintf(stdout, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
-
-        while(!glfwWindowShouldClose(window)) {
-                glfwMakeContextCurrent(window);
-
+        render->mailbox.must_close.store(false);
+        render->mailbox.has_stopped.store(false);
+        render->mailbox.key_write_count.store(0);
+        render->mailbox.key_read_count.store(0);
+        {
                 int width, height;
                 glfwGetFramebufferSize(window, &width, &height);
-                glViewport(0, 0, width, height);
+                mailbox_post_framebuffer_size(&render->mailbox, window, width,
+                                              height);
+        }
 
-                try {
-                        // TODO(uucidl) square pixels are assumed here
-                        render_next_gl3(now_micros(), { static_cast<uint32_t> (width), static_cast<uint32_t> (height) });
-                } catch (std::exception& e) {
-                        fprintf(stderr, "caught exception: '%s', exiting.\n", e.what());
-                        break;
-                }
-                glfwSwapBuffers(window);
+        glfwSetWindowUserPointer(window, render);
+        glfwSetKeyCallback(window, do_keyboard);
+        glfwSetMouseButtonCallback(window, do_mouse_button);
+        glfwSetFramebufferSizeCallback(window, do_framebuffer_size);
+
+        render->thread = std::thread(render_loop, render);
+
+        while (!glfwWindowShouldClose(window) &&
+               !render->mailbox.has_stopped.load()) {
+                // nothing would wake us when the render thread stops
                 glfwPollEvents();
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
         }
 
+        render->mailbox.must_close.store(true);
+        render->thread.join();
+        delete render;
+
         glfwDestroyWindow(window);
         glfwTerminate();
 }
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Conversion of 8bit RGBA pixels to planar YUV 4:2:0, with the BT.601
+ * limited range matrix expected by video encoders.
+ *
+ * Each chroma sample is computed from the average color of the 2x2
+ * pixels it covers (centered siting, as in JPEG.)
+ *
+ * The implementation is chosen at startup according to the
+ * instruction sets of the cpu.
+ */
+
+/**
+ * converts a pair of rows into two rows of luma and one row of each
+ * chroma plane, which has (width + 1) / 2 samples.
+ *
+ * For images of odd height, the last row can be passed as both rows.
+ */
+extern void pixel_convert_rgba_to_yuv420(uint8_t luma_row0[],
+                uint8_t luma_row1[],
+                uint8_t u_row[],
+                uint8_t v_row[],
+                uint8_t const rgba_row0[],
+                uint8_t const rgba_row1[],
+                int width);
+
+/// name of the implementation in use, i.e. "sse2"
+extern char const* pixel_convert_implementation();
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "allocator_type.h"
+
+enum {
+        POOL_ALLOCATOR_CLASS_COUNT = 9, // blocks of 16 to 4096 bytes
+        POOL_ALLOCATOR_PAGE_SIZE = 4096, // each class takes whole pages
+        POOL_ALLOCATOR_MIN_CAPACITY =
+                POOL_ALLOCATOR_CLASS_COUNT * POOL_ALLOCATOR_PAGE_SIZE,
+};
+
+struct PoolSizeClass {
+        size_t block_size;
+        char* begin;
+        char* end;
+        void* local_free; // owner only
+        std::atomic<void*> remote_free; // pushed to by other threads
+};
+
+/**
+ * Allocator of fixed size blocks, for the audio thread.
+ *
+ * All blocks are allocated and touched up front, in power of two size
+ * classes. The thread owning the pool allocates and frees without
+ * waiting, from its own free lists. Other threads may only free: their
+ * blocks are pushed onto a lock-free list, which the owner takes over
+ * in one go when its own list runs out.
+ *
+ * Requests larger than the biggest class, or than what is left, fail.
+ */
+struct PoolAllocator {
+        struct Allocator allocator; // first, to be usable as an Allocator
+        struct Allocator* parent;
+        char* memory;
+        std::atomic<void const*> owner;
+        struct PoolSizeClass classes[POOL_ALLOCATOR_CLASS_COUNT];
+};
+
+/**
+ * @param capacity bytes, shared equally between the size classes, in
+ * whole pages. At least POOL_ALLOCATOR_MIN_CAPACITY.
+ * @param block_padding bytes added to every block, for a decorator
+ * prefixing blocks with its own header. A multiple of 16.
+ */
+extern int pool_allocator_init(struct PoolAllocator* pool,
+                               struct Allocator* parent,
+                               size_t capacity,
+                               size_t block_padding);
+extern void pool_allocator_deinit(struct PoolAllocator* pool);
+
+/// makes the calling thread the owner of the pool
+extern void pool_allocator_claim(struct PoolAllocator* pool);
@@ -0,0 +1,23 @@
+#pragma once
+
+/**
+ * prepares the calling thread for realtime audio work, logging what
+ * was granted under the given name:
+ *
+ * - realtime scheduling (SCHED_FIFO, or time critical priority on
+ *   windows) at the given priority, from 1 to 99. Higher priorities
+ *   preempt lower ones.
+ * - pinning to the cpu named by the cpu_variable environment variable,
+ *   when set. Darwin only takes it as an affinity hint.
+ * - flushing denormals to zero, so that decaying signals do not slow
+ *   down the floating point unit.
+ * - locking the memory of the process when MICROS_MLOCK=1 is set. On
+ *   windows, the working set grows by 64MiB instead and only the stack
+ *   of the first thread set up is locked.
+ *
+ * Every step is optional: without the privileges for it, the thread
+ * carries on without it.
+ */
+extern void realtime_thread_setup(char const* name,
+                                  int priority,
+                                  char const* cpu_variable);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Conversions between the planar double samples of the audio entry
+ * points and the interleaved stereo formats of devices and files.
+ *
+ * Integer formats use the full scale of their type, and out of range
+ * samples are clipped.
+ *
+ * The implementation is chosen at startup according to the
+ * instruction sets of the cpu.
+ */
+
+extern void sample_convert_f64_planar_to_f32(float interleaved[],
+                double const left[],
+                double const right[],
+                int frame_count);
+
+extern void sample_convert_f64_planar_to_s16(int16_t interleaved[],
+                double const left[],
+                double const right[],
+                int frame_count);
+
+extern void sample_convert_f64_planar_to_s32(int32_t interleaved[],
+                double const left[],
+                double const right[],
+                int frame_count);
+
+extern void sample_convert_f32_to_f64_planar(double left[],
+                double right[],
+                float const interleaved[],
+                int frame_count);
+
+extern void sample_convert_s16_to_f64_planar(double left[],
+                double right[],
+                int16_t const interleaved[],
+                int frame_count);
+
+extern void sample_convert_s32_to_f64_planar(double left[],
+                double right[],
+                int32_t const interleaved[],
+                int frame_count);
+
+/// converts interleaved float samples for 16bit devices
+extern void sample_convert_f32_to_s16(int16_t dest[],
+                                      float const source[],
+                                      int sample_count);
+
+/// name of the implementation in use, i.e. "avx2"
+extern char const* sample_convert_implementation();
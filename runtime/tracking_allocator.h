@@ -0,0 +1,60 @@
+#pragma once
+
+#include "allocator_type.h"
+
+/**
+ * Decorator recording what goes through another allocator: live and
+ * peak bytes, allocation counts and a histogram of sizes, per thread
+ * and per tag.
+ *
+ * Allocations made from within the audio entry points are counted
+ * separately, and reported as they happen unless the allocator is
+ * realtime safe.
+ *
+ * Enabled with MICROS_TRACK_MEMORY=1, or when built with
+ * MICROS_TRACK_NEW, which also routes the global operator new through
+ * it. A summary is printed at exit.
+ */
+struct TrackingAllocator {
+        struct Allocator allocator; // first, to be usable as an Allocator
+        struct Allocator* parent;
+        char const* tag;
+        bool is_realtime_safe;
+};
+
+extern bool tracking_allocator_is_enabled();
+
+extern void tracking_allocator_init(struct TrackingAllocator* tracking,
+                                    struct Allocator* parent,
+                                    char const* tag,
+                                    bool is_realtime_safe);
+
+/// @return allocator, or its tracking decorator when tracking is enabled
+extern struct Allocator* tracking_allocator_wrap(
+        struct TrackingAllocator* tracking,
+        struct Allocator* allocator,
+        char const* tag,
+        bool is_realtime_safe);
+
+/**
+ * @return the bytes added in front of each allocation by decorators,
+ * 0 when tracking is disabled
+ */
+extern size_t tracking_allocator_overhead();
+
+/**
+ * creates the statistics of the calling thread, which would otherwise
+ * be allocated on its first tracked allocation. Audio threads call it
+ * before rendering.
+ */
+extern void tracking_allocator_prepare_thread();
+
+/**
+ * for decorators of arenas: accounts for the release of everything the
+ * calling thread allocated through tracking.
+ */
+extern void tracking_allocator_release_all(struct TrackingAllocator* tracking);
+
+/// marks the calling thread as running the audio entry points
+extern void tracking_allocator_begin_audio();
+extern void tracking_allocator_end_audio();
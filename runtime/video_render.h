@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+struct FrameInfo;
+
+/// the frames rendered so far by a window or an offline render
+struct VideoRender {
+        uint64_t frame_count;
+        uint64_t last_time_micros;
+};
+
+extern void video_render_init(struct VideoRender* render);
+
+/**
+ * calls the demo's video entry point for the next frame.
+ *
+ * The caller fills the display, times and scales of frame_info, while
+ * its version, size, frame index and delta time are filled here.
+ */
+extern void video_render_frame(struct VideoRender* render,
+                               struct FrameInfo* frame_info);
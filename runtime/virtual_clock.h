@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+struct Allocator;
+struct Clock;
+
+/**
+ * Demo time, derived from the time of a real clock.
+ *
+ * It can be paused, moved to any time, and run slower or faster than
+ * the real clock. In fixed step mode, each video frame advances it by
+ * the same amount, whatever the time it took to render.
+ *
+ * Demo time starts at zero, like offline renders, so that runs can be
+ * replayed and compared.
+ *
+ * The video thread controls it, while the audio threads only read it.
+ */
+struct VirtualClock {
+        struct Allocator* allocator;
+        struct Clock* clock;
+        uint64_t step_micros; // between video frames, 0 for continuous time
+
+        /**
+         * demo time is origin_micros + (clock time - clock_origin_micros) *
+         * rate / 65536. Writers bump sequence before and after updating
+         * these, so readers can retry on a torn read.
+         */
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint64_t> clock_origin_micros;
+        std::atomic<uint64_t> origin_micros;
+        std::atomic<uint64_t> rate; // 16.16 fixed point, 0 when paused
+
+        // video thread only
+        uint64_t unpaused_rate;
+        uint64_t frame_micros;
+        bool must_resync_frame;
+};
+
+/// whether MICROS_VIRTUAL_CLOCK=1 asks for demo time to be virtual
+extern bool virtual_clock_is_requested();
+
+/**
+ * @param clock the real clock
+ *
+ * MICROS_TIME_START=<seconds>, MICROS_TIME_RATE=<factor> and
+ * MICROS_TIME_STEP_FPS=<fps> set the initial state.
+ */
+extern int virtual_clock_init(struct VirtualClock** virtual_clockp,
+                              struct Allocator* allocator,
+                              struct Clock* clock);
+extern void virtual_clock_deinit(struct VirtualClock** virtual_clockp);
+
+/// current demo time
+extern uint64_t virtual_clock_micros(struct VirtualClock const* virtual_clock);
+
+/**
+ * converts a time of the real clock (for instance when an audio buffer
+ * will be played) into demo time.
+ */
+extern uint64_t virtual_clock_map(struct VirtualClock const* virtual_clock,
+                                  uint64_t clock_micros,
+                                  bool* is_paused);
+
+/**
+ * video thread: demo time of the next frame
+ *
+ * @param present_micros when the frame will be presented, in real clock
+ * time; unused in fixed step mode.
+ */
+extern uint64_t virtual_clock_next_frame(struct VirtualClock* virtual_clock,
+                uint64_t present_micros);
+
+/// video thread: controls
+extern void virtual_clock_toggle_pause(struct VirtualClock* virtual_clock);
+extern void virtual_clock_seek(struct VirtualClock* virtual_clock,
+                               uint64_t micros);
+extern void virtual_clock_set_rate(struct VirtualClock* virtual_clock,
+                                   double rate);
+extern double virtual_clock_rate(struct VirtualClock const* virtual_clock);
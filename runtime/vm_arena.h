@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+
+#include "allocator_type.h"
+
+enum VmArenaPages {
+        VM_ARENA_PAGES_SMALL,
+        VM_ARENA_PAGES_TRANSPARENT_HUGE, // advised, the kernel may decline
+        VM_ARENA_PAGES_EXPLICIT_HUGE, // from the reserved hugetlb pool
+};
+
+/**
+ * Linear allocator over a range of virtual memory, reserved up front
+ * and committed as allocations reach into it.
+ *
+ * Allocations never move: the latest one can grow in place up to the
+ * end of the reservation, which spares the copies of a growing buffer.
+ * Resetting only rewinds the arena, keeping its pages committed.
+ */
+struct VmArena {
+        struct Allocator allocator; // first, to be usable as an Allocator
+        char* base;
+        size_t reserved;
+        size_t committed;
+        size_t used;
+        size_t last_offset; // of the latest allocation
+        size_t commit_granularity;
+        enum VmArenaPages pages;
+};
+
+/**
+ * @param pages the kind of pages wanted, falling back on smaller ones
+ * when unavailable. The arena's pages field tells which were used.
+ */
+extern int vm_arena_init(struct VmArena* arena,
+                         size_t reserved,
+                         enum VmArenaPages pages);
+extern void vm_arena_deinit(struct VmArena* arena);
+extern void vm_arena_reset(struct VmArena* arena);
+
+/// grows the latest allocation in place, if ptr is it
+extern bool vm_arena_grow(struct VmArena* arena, void* ptr, size_t size);
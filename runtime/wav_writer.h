@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * streams 48khz stereo float samples to a WAV file.
+ */
+struct WavWriter {
+        FILE* file;
+        uint64_t frame_count;
+};
+
+extern int wav_writer_open(struct WavWriter* writer, char const* path);
+extern int wav_writer_write(struct WavWriter* writer,
+                            float const interleaved[/*2*frame_count*/],
+                            int frame_count);
+/// patches the header with the final sizes and closes the file
+extern int wav_writer_close(struct WavWriter* writer);